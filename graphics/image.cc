@@ -7,7 +7,9 @@
 #include "image.h"
 
 #include <assert.h>
+#include <string.h>
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -22,15 +24,108 @@ namespace graphics {
 
 namespace {
 constexpr int MAX_PIXEL_VALUE = 255;
+
+std::string FormatViolation(Violation violation, int first, int second) {
+  switch (violation) {
+    case Violation::kPixelOutOfBounds:
+      return "(" + std::to_string(first) + ", " + std::to_string(second) +
+             ") is out of bounds.";
+    case Violation::kColorOutOfRange:
+      return std::to_string(first) +
+             " is out of range, must be between 0 and 255.";
+    case Violation::kMissingChannel:
+      return "Channel " + std::to_string(first) + " is not in the image.";
+  }
+  return "";
+}
+}  // namespace
+
+// static
+ImageDiagnostics& ImageDiagnostics::GetInstance() {
+  static ImageDiagnostics instance;
+  return instance;
+}
+
+ImageDiagnostics::~ImageDiagnostics() { Flush(); }
+
+void ImageDiagnostics::SetSink(DiagnosticsSink* sink) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  sink_ = sink;
+}
+
+void ImageDiagnostics::SetMaxMessages(int max_messages) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  max_messages_ = max_messages;
+  num_written_ = 0;
+}
+
+void ImageDiagnostics::Report(Violation violation, int first, int second) {
+  counts_[static_cast<int>(violation)].fetch_add(1, std::memory_order_relaxed);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (has_previous_ && violation == previous_violation_ &&
+      first == previous_first_ && second == previous_second_) {
+    num_repeats_++;
+    return;
+  }
+  WriteRepeats();
+  has_previous_ = true;
+  previous_violation_ = violation;
+  previous_first_ = first;
+  previous_second_ = second;
+  previous_written_ = max_messages_ < 0 || num_written_ < max_messages_;
+  if (!previous_written_) {
+    num_suppressed_++;
+    return;
+  }
+  num_written_++;
+  WriteLine(FormatViolation(violation, first, second));
+}
+
+void ImageDiagnostics::Flush() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  WriteRepeats();
+  if (num_suppressed_ > 0) {
+    WriteLine(std::to_string(num_suppressed_) +
+              " more image errors were not shown. In total: " +
+              std::to_string(GetCount(Violation::kPixelOutOfBounds)) +
+              " pixels out of bounds, " +
+              std::to_string(GetCount(Violation::kColorOutOfRange)) +
+              " colors out of range, " +
+              std::to_string(GetCount(Violation::kMissingChannel)) +
+              " missing channels.");
+    num_suppressed_ = 0;
+  }
+  if (!sink_) cout.flush();
+}
+
+void ImageDiagnostics::Reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (std::atomic<int64_t>& count : counts_) {
+    count.store(0, std::memory_order_relaxed);
+  }
+  num_written_ = 0;
+  num_suppressed_ = 0;
+  has_previous_ = false;
+  num_repeats_ = 0;
+}
+
+void ImageDiagnostics::WriteLine(const std::string& line) {
+  if (sink_) {
+    sink_->Write(line);
+  } else {
+    // No std::endl: flushing every line makes printing many messages slow.
+    cout << line << '\n';
+  }
 }
 
-Color::Color(int red, int green, int blue) {
-  if (red < 0 || red > MAX_PIXEL_VALUE) red = 0;
-  if (blue < 0 || blue > MAX_PIXEL_VALUE) blue = 0;
-  if (green < 0 || green > MAX_PIXEL_VALUE) green = 0;
-  red_ = red;
-  green_ = green;
-  blue_ = blue;
+void ImageDiagnostics::WriteRepeats() {
+  if (num_repeats_ == 0) return;
+  if (previous_written_) {
+    WriteLine("(Repeated " + std::to_string(num_repeats_) + " more times.)");
+  } else {
+    num_suppressed_ += num_repeats_;
+  }
+  num_repeats_ = 0;
 }
 
 Image::Image() = default;
@@ -53,10 +148,14 @@ bool Image::Load(const string& filename) {
     cimage_->load(filename.c_str());
   } catch (CImgException& e) {
     cout << "Failed to open image file " << filename << endl;
+    width_ = 0;
+    height_ = 0;
+    pixels_ = nullptr;
     return false;
   }
   width_ = cimage_->width();
   height_ = cimage_->height();
+  pixels_ = cimage_->data();
   if (!IsValid()) {
     cout << "Invaild image file " << filename << endl;
     return false;
@@ -72,6 +171,7 @@ bool Image::Initialize(int width, int height) {
                                                           MAX_PIXEL_VALUE);
   width_ = width;
   height_ = height;
+  pixels_ = cimage_->data();
   return true;
 }
 
@@ -138,33 +238,35 @@ void Image::Hide() {
   }
 }
 
-Color Image::GetColor(int x, int y) const {
-  if (!CheckPixelInBounds(x, y)) {
-    return Color(0, 0, 0);
+PixelSpan<uint8_t> Image::GetRow(int y, Channel channel) {
+  if (!CheckChannelInBounds(channel) || !CheckPixelInBounds(0, y)) {
+    return PixelSpan<uint8_t>();
   }
-  Color color(GetRed(x, y), GetGreen(x, y), GetBlue(x, y));
-  return color;
+  return PixelSpan<uint8_t>(cimage_->data(0, y, static_cast<int>(channel)),
+                            width_);
 }
 
-int Image::GetRed(int x, int y) const { return GetPixel(x, y, 0); }
-
-int Image::GetGreen(int x, int y) const { return GetPixel(x, y, 1); }
-
-int Image::GetBlue(int x, int y) const { return GetPixel(x, y, 2); }
-
-bool Image::SetColor(int x, int y, const Color& color) {
-  if (!CheckPixelInBounds(x, y)) {
-    return false;
+PixelSpan<const uint8_t> Image::GetRow(int y, Channel channel) const {
+  if (!CheckChannelInBounds(channel) || !CheckPixelInBounds(0, y)) {
+    return PixelSpan<const uint8_t>();
   }
-  return SetRed(x, y, color.Red()) && SetGreen(x, y, color.Green()) &&
-         SetBlue(x, y, color.Blue());
+  return PixelSpan<const uint8_t>(
+      cimage_->data(0, y, static_cast<int>(channel)), width_);
 }
 
-bool Image::SetRed(int x, int y, int r) { return SetPixel(x, y, 0, r); }
-
-bool Image::SetGreen(int x, int y, int g) { return SetPixel(x, y, 1, g); }
+PixelSpan<uint8_t> Image::GetPlane(Channel channel) {
+  if (!CheckChannelInBounds(channel)) return PixelSpan<uint8_t>();
+  // CImg stores each channel as its own contiguous plane.
+  return PixelSpan<uint8_t>(cimage_->data(0, 0, static_cast<int>(channel)),
+                            static_cast<size_t>(width_) * height_);
+}
 
-bool Image::SetBlue(int x, int y, int b) { return SetPixel(x, y, 2, b); }
+PixelSpan<const uint8_t> Image::GetPlane(Channel channel) const {
+  if (!CheckChannelInBounds(channel)) return PixelSpan<const uint8_t>();
+  return PixelSpan<const uint8_t>(
+      cimage_->data(0, 0, static_cast<int>(channel)),
+      static_cast<size_t>(width_) * height_);
+}
 
 bool Image::DrawLine(int x0, int y0, int x1, int y1, int red, int green,
                      int blue, int thickness) {
@@ -248,6 +350,100 @@ bool Image::DrawText(int x, int y, const string& text, int font_size, int red,
   return true;
 }
 
+bool Image::DrawImage(int x, int y, const Image& image, int image_x,
+                      int image_y, int width, int height) {
+  // Every destination channel is written, so a grayscale destination can't
+  // hold the region.
+  if (!IsValid() || !image.IsValid() || cimage_->spectrum() < 3) {
+    return false;
+  }
+  // Clip the region to the source and then to the destination.
+  if (image_x < 0) {
+    width += image_x;
+    x -= image_x;
+    image_x = 0;
+  }
+  if (image_y < 0) {
+    height += image_y;
+    y -= image_y;
+    image_y = 0;
+  }
+  if (x < 0) {
+    width += x;
+    image_x -= x;
+    x = 0;
+  }
+  if (y < 0) {
+    height += y;
+    image_y -= y;
+    y = 0;
+  }
+  width = std::min(width, std::min(image.GetWidth() - image_x, GetWidth() - x));
+  height =
+      std::min(height, std::min(image.GetHeight() - image_y, GetHeight() - y));
+  if (width <= 0 || height <= 0) {
+    return true;
+  }
+  // Each channel is stored as its own plane, so rows of a channel are
+  // contiguous and can be copied at once. When drawing an image onto itself
+  // the regions may overlap, so rows are moved rather than copied, bottom up
+  // if the region moves down.
+  const int source_channels = image.cimage_->spectrum();
+  const bool bottom_up = &image == this && y > image_y;
+  for (int channel = 0; channel < 3; channel++) {
+    const int source_channel = std::min(channel, source_channels - 1);
+    if (width == GetWidth() && width == image.GetWidth()) {
+      // Whole rows: the region is one contiguous block in both images.
+      memmove(cimage_->data(0, y, channel),
+              image.cimage_->data(0, image_y, source_channel), width * height);
+      continue;
+    }
+    for (int i = 0; i < height; i++) {
+      const int row = bottom_up ? height - 1 - i : i;
+      memmove(cimage_->data(x, y + row, channel),
+              image.cimage_->data(image_x, image_y + row, source_channel),
+              width);
+    }
+  }
+  return true;
+}
+
+bool Image::DrawImage(int x, int y, const Image& image,
+                      const Color& transparent_color) {
+  if (!IsValid() || !image.IsValid() || cimage_->spectrum() < 3 ||
+      image.cimage_->spectrum() < 3) {
+    return false;
+  }
+  const int image_x = std::max(0, -x);
+  const int image_y = std::max(0, -y);
+  const int width = std::min(image.GetWidth(), GetWidth() - x) - image_x;
+  const int height = std::min(image.GetHeight(), GetHeight() - y) - image_y;
+  if (width <= 0 || height <= 0) {
+    return true;
+  }
+  const uint8_t key[] = {static_cast<uint8_t>(transparent_color.Red()),
+                         static_cast<uint8_t>(transparent_color.Green()),
+                         static_cast<uint8_t>(transparent_color.Blue())};
+  for (int row = image_y; row < image_y + height; row++) {
+    const uint8_t* source[3];
+    uint8_t* destination[3];
+    for (int channel = 0; channel < 3; channel++) {
+      source[channel] = image.cimage_->data(image_x, row, channel);
+      destination[channel] = cimage_->data(x + image_x, y + row, channel);
+    }
+    for (int i = 0; i < width; i++) {
+      if (source[0][i] == key[0] && source[1][i] == key[1] &&
+          source[2][i] == key[2]) {
+        continue;
+      }
+      destination[0][i] = source[0][i];
+      destination[1][i] = source[1][i];
+      destination[2][i] = source[2][i];
+    }
+  }
+  return true;
+}
+
 void Image::ProcessEvent() {
   int mouse_x = display_->mouse_x();
   int mouse_y = display_->mouse_y();
@@ -298,7 +494,7 @@ void Image::ProcessAnimation() {
 
 bool Image::CheckPixelInBounds(int x, int y) const {
   if (x < 0 || y < 0 || x >= GetWidth() || y >= GetHeight()) {
-    cout << "(" << x << ", " << y << ") is out of bounds." << endl;
+    ImageDiagnostics::GetInstance().Report(Violation::kPixelOutOfBounds, x, y);
     return false;
   }
   return true;
@@ -306,7 +502,7 @@ bool Image::CheckPixelInBounds(int x, int y) const {
 
 bool Image::CheckColorInBounds(int value) const {
   if (value < 0 || value > MAX_PIXEL_VALUE) {
-    cout << value << " is out of range, must be between 0 and 255." << endl;
+    ImageDiagnostics::GetInstance().Report(Violation::kColorOutOfRange, value);
     return false;
   }
   return true;
@@ -314,27 +510,112 @@ bool Image::CheckColorInBounds(int value) const {
 
 bool Image::CheckColorInBounds(const int value[]) const {
   for (int i = 0; i < 3; i++) {
-    if (value[i] < 0 || value[i] > MAX_PIXEL_VALUE) {
-      cout << value[i] << " is out of range, must be between 0 and 255."
-           << endl;
-      return false;
-    }
+    if (!CheckColorInBounds(value[i])) return false;
   }
   return true;
 }
 
-int Image::GetPixel(int x, int y, int channel) const {
-  if (!CheckPixelInBounds(x, y)) return -1;
-  const uint8_t* r = cimage_->data(x, y, channel);
-  return static_cast<int>(*r);
+bool Image::CheckChannelInBounds(Channel channel) const {
+  if (!IsValid() || static_cast<int>(channel) >= cimage_->spectrum()) {
+    ImageDiagnostics::GetInstance().Report(Violation::kMissingChannel,
+                                           static_cast<int>(channel));
+    return false;
+  }
+  return true;
 }
 
-bool Image::SetPixel(int x, int y, int channel, int value) {
-  if (!CheckPixelInBounds(x, y)) return false;
-  if (!CheckColorInBounds(value)) return false;
-  uint8_t* px = cimage_->data(x, y, channel);
-  *px = static_cast<uint8_t>(value);
-  // Inefficient. Should we have a "flush" or similar?
+InterleavedImage::InterleavedImage(int width, int height)
+    : width_(std::max(width, 0)),
+      height_(std::max(height, 0)),
+      pixels_(static_cast<size_t>(width_) * height_,
+              Color(MAX_PIXEL_VALUE, MAX_PIXEL_VALUE, MAX_PIXEL_VALUE)) {}
+
+InterleavedImage::InterleavedImage(const Image& image)
+    : width_(image.GetWidth()),
+      height_(image.GetHeight()),
+      pixels_(static_cast<size_t>(width_) * height_) {
+  if (!image.IsValid()) return;
+  const size_t size = pixels_.size();
+  const int channels = image.cimage_->spectrum();
+  // Grayscale images have one plane, which is used for every channel.
+  const uint8_t* red = image.pixels_;
+  const uint8_t* green = red + (channels >= 3 ? size : 0);
+  const uint8_t* blue = red + (channels >= 3 ? 2 * size : 0);
+  // Simple enough for compilers to vectorize into shuffles of whole
+  // registers.
+  Color* out = pixels_.data();
+  for (size_t i = 0; i < size; i++) {
+    out[i] = Color::FromRGBA(red[i] | green[i] << 8 | blue[i] << 16);
+  }
+}
+
+PixelSpan<Color> InterleavedImage::GetRow(int y) {
+  if (!PixelInBounds<BoundsCheck::kChecked>(0, y)) return PixelSpan<Color>();
+  return PixelSpan<Color>(&pixels_[static_cast<size_t>(y) * width_], width_);
+}
+
+PixelSpan<const Color> InterleavedImage::GetRow(int y) const {
+  if (!PixelInBounds<BoundsCheck::kChecked>(0, y)) {
+    return PixelSpan<const Color>();
+  }
+  return PixelSpan<const Color>(&pixels_[static_cast<size_t>(y) * width_],
+                                width_);
+}
+
+void InterleavedImage::CopyTo(Image* image) const {
+  if (width_ < 1 || height_ < 1) return;
+  if (image->GetWidth() != width_ || image->GetHeight() != height_ ||
+      image->cimage_->spectrum() != 3) {
+    image->Initialize(width_, height_);
+  }
+  const size_t size = pixels_.size();
+  uint8_t* red = image->pixels_;
+  uint8_t* green = red + size;
+  uint8_t* blue = green + size;
+  const Color* in = pixels_.data();
+  for (size_t i = 0; i < size; i++) {
+    uint32_t rgba = in[i].GetRGBA();
+    red[i] = static_cast<uint8_t>(rgba);
+    green[i] = static_cast<uint8_t>(rgba >> 8);
+    blue[i] = static_cast<uint8_t>(rgba >> 16);
+  }
+}
+
+void InterleavedImage::Export(PixelFormat format, uint8_t* out) const {
+  const size_t size = pixels_.size();
+  const Color* in = pixels_.data();
+  if (format == PixelFormat::kRGBA) {
+    // Alpha is always 255, so the packed values are already RGBA8 bytes.
+    for (size_t i = 0; i < size; i++) {
+      uint32_t rgba = in[i].GetRGBA();
+      out[4 * i] = static_cast<uint8_t>(rgba);
+      out[4 * i + 1] = static_cast<uint8_t>(rgba >> 8);
+      out[4 * i + 2] = static_cast<uint8_t>(rgba >> 16);
+      out[4 * i + 3] = static_cast<uint8_t>(rgba >> 24);
+    }
+    return;
+  }
+  for (size_t i = 0; i < size; i++) {
+    uint32_t rgba = in[i].GetRGBA();
+    out[3 * i] = static_cast<uint8_t>(rgba);
+    out[3 * i + 1] = static_cast<uint8_t>(rgba >> 8);
+    out[3 * i + 2] = static_cast<uint8_t>(rgba >> 16);
+  }
+}
+
+bool InterleavedImage::Import(PixelFormat format, int width, int height,
+                              const uint8_t* in) {
+  if (width < 1 || height < 1) return false;
+  width_ = width;
+  height_ = height;
+  pixels_.resize(static_cast<size_t>(width) * height);
+  const size_t size = pixels_.size();
+  const size_t bytes_per_pixel = format == PixelFormat::kRGBA ? 4 : 3;
+  Color* out = pixels_.data();
+  for (size_t i = 0; i < size; i++) {
+    const uint8_t* pixel = in + bytes_per_pixel * i;
+    out[i] = Color::FromRGBA(pixel[0] | pixel[1] << 8 | pixel[2] << 16);
+  }
   return true;
 }
 
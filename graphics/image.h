@@ -4,10 +4,18 @@
 // license that can be found in the LICENSE file or at
 // https://opensource.org/licenses/MIT.
 
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 #include "image_event.h"
 
@@ -29,60 +37,248 @@ const int kDefaultAnimationMs = 30;
 /**
  * Represents an RGB pixel color, where |red|, |green| and |blue|
  * may be between 0 and 255, inclusive. Default color is black.
+ *
+ * Packed into a 32-bit value with red in the lowest byte, then green, blue
+ * and alpha in the highest byte, with alpha always 255 (opaque). Colors are
+ * trivially copyable and may be constexpr, so color constants cost nothing at
+ * run time and arrays of colors are compact.
  */
 class Color {
  public:
-  explicit Color(int red = 0, int green = 0, int blue = 0);
-
-  // Copy constructor.
-  Color(const Color& other) {
-    red_ = other.Red();
-    green_ = other.Green();
-    blue_ = other.Blue();
+  /**
+   * Creates a color. Channels out of the range [0, 255] are set to 0.
+   */
+  constexpr explicit Color(int red = 0, int green = 0, int blue = 0)
+      : rgba_(Pack(ValidOrZero(red), ValidOrZero(green), ValidOrZero(blue))) {
   }
 
-  // Assignment operator.
-  Color& operator=(const Color& other) {
-    red_ = other.Red();
-    green_ = other.Green();
-    blue_ = other.Blue();
-    return *this;
+  /**
+   * Creates a color from RGBA8 bytes packed as by GetRGBA. Alpha is ignored.
+   */
+  static constexpr Color FromRGBA(uint32_t rgba) {
+    Color color;
+    color.rgba_ = rgba | kAlphaMask;
+    return color;
   }
 
-  ~Color() = default;
+  /**
+   * Returns the red, green, blue and alpha bytes, packed with red in the
+   * lowest byte.
+   */
+  constexpr uint32_t GetRGBA() const { return rgba_; }
 
   // Equality operator.
-  bool operator==(const Color& other) const {
-    return red_ == other.Red() && green_ == other.Green() && blue_ == other.Blue();
+  constexpr bool operator==(const Color& other) const {
+    return rgba_ == other.rgba_;
   }
 
   // Inequality operator.
-  bool operator!=(const Color& other) const {
-    return red_ != other.Red() || green_ != other.Green() || blue_ != other.Blue();
+  constexpr bool operator!=(const Color& other) const {
+    return rgba_ != other.rgba_;
   }
 
   // Getters
-  int Red() const { return red_; }
-  int Green() const { return green_; }
-  int Blue() const { return blue_; }
+  constexpr int Red() const { return rgba_ & 0xff; }
+  constexpr int Green() const { return (rgba_ >> 8) & 0xff; }
+  constexpr int Blue() const { return (rgba_ >> 16) & 0xff; }
 
-  // Setters
-  void SetRed(int red) { red_ = red; }
-  void SetGreen(int green) { green_ = green; }
-  void SetBlue(int blue) { blue_ = blue; }
+  // Setters. Like the constructor, values out of the range [0, 255] are set
+  // to 0.
+  constexpr void SetRed(int red) { SetChannel(0, red); }
+  constexpr void SetGreen(int green) { SetChannel(8, green); }
+  constexpr void SetBlue(int blue) { SetChannel(16, blue); }
 
  private:
-  int red_;
-  int green_;
-  int blue_;
+  static constexpr uint32_t kAlphaMask = 0xff000000u;
+
+  static constexpr uint32_t ValidOrZero(int value) {
+    return value < 0 || value > 255 ? 0 : static_cast<uint32_t>(value);
+  }
+
+  static constexpr uint32_t Pack(uint32_t red, uint32_t green,
+                                 uint32_t blue) {
+    return red | green << 8 | blue << 16 | kAlphaMask;
+  }
+
+  constexpr void SetChannel(int shift, int value) {
+    rgba_ = (rgba_ & ~(0xffu << shift)) | ValidOrZero(value) << shift;
+  }
+
+  uint32_t rgba_;
 };
 
+static_assert(std::is_trivially_copyable<Color>::value &&
+                  sizeof(Color) == sizeof(uint32_t),
+              "Color must be a packed 32-bit value");
+
 // Use by gtest.
 static void PrintTo(const Color& color, std::ostream* stream) {
   *stream << "Color: (" << color.Red() << "," << color.Green() << ","
           << color.Blue() << ")";
 }
 
+/**
+ * The color channels of an Image.
+ */
+enum class Channel { kRed = 0, kGreen = 1, kBlue = 2 };
+
+/**
+ * Kinds of invalid arguments which may be passed to Image methods.
+ */
+enum class Violation {
+  // A pixel outside of the image.
+  kPixelOutOfBounds = 0,
+  // A color value outside of [0, 255].
+  kColorOutOfRange,
+  // A channel the image does not have.
+  kMissingChannel,
+};
+
+/**
+ * Where ImageDiagnostics writes its messages. Implement this to send them
+ * somewhere other than std::cout, such as a log or a test.
+ */
+class DiagnosticsSink {
+ public:
+  virtual ~DiagnosticsSink() = default;
+
+  /**
+   * Writes one line, which does not end in a newline.
+   */
+  virtual void Write(const std::string& line) = 0;
+};
+
+/**
+ * Counts and reports invalid arguments passed to any Image, such as drawing
+ * off the edge of the image. Every violation is counted, but to keep a buggy
+ * loop from spending all its time printing:
+ *  - a message which repeats the previous one is not written again; how
+ *    many times it repeated is written when a different message arrives or
+ *    on Flush.
+ *  - after the first |max_messages| messages are written, the rest are only
+ *    counted, and Flush writes a summary of how many were suppressed.
+ * Messages go to std::cout, without flushing it, unless a sink is set.
+ * Flush is called when the program exits. Safe to use from many threads.
+ */
+class ImageDiagnostics {
+ public:
+  // The default for SetMaxMessages.
+  static constexpr int kDefaultMaxMessages = 100;
+
+  /**
+   * Gets the diagnostics shared by all images.
+   */
+  static ImageDiagnostics& GetInstance();
+
+  ~ImageDiagnostics();
+
+  /**
+   * Sends messages to |sink|, which is unowned and must stay alive until
+   * the sink is changed, or to std::cout if |sink| is nullptr.
+   */
+  void SetSink(DiagnosticsSink* sink);
+
+  /**
+   * Sets how many messages are written before the rest are suppressed, or
+   * -1 for no limit. Also restarts the count of written messages.
+   */
+  void SetMaxMessages(int max_messages);
+
+  /**
+   * Counts a violation and writes its message, unless it is a repeat or the
+   * limit has been reached. |first| and |second| are the offending values,
+   * such as a pixel's x and y.
+   */
+  void Report(Violation violation, int first, int second = 0);
+
+  /**
+   * Returns how many times |violation| has been reported.
+   */
+  int64_t GetCount(Violation violation) const {
+    return counts_[static_cast<int>(violation)].load(
+        std::memory_order_relaxed);
+  }
+
+  /**
+   * Writes any pending repeat count and a summary of suppressed messages.
+   */
+  void Flush();
+
+  /**
+   * Sets all counts to zero and forgets the previous message.
+   */
+  void Reset();
+
+ private:
+  ImageDiagnostics() = default;
+
+  // Writes |line| to the sink. |mutex_| must be held.
+  void WriteLine(const std::string& line);
+
+  // Writes how many times the previous message repeated, if it did.
+  // |mutex_| must be held.
+  void WriteRepeats();
+
+  static constexpr int kNumViolations = 3;
+
+  std::atomic<int64_t> counts_[kNumViolations] = {};
+  std::mutex mutex_;
+  DiagnosticsSink* sink_ = nullptr;
+  int max_messages_ = kDefaultMaxMessages;
+  int num_written_ = 0;
+  int64_t num_suppressed_ = 0;
+  // The previous message, as arguments to Report, whether it was written,
+  // and how many times it was repeated since.
+  bool has_previous_ = false;
+  bool previous_written_ = false;
+  Violation previous_violation_ = Violation::kPixelOutOfBounds;
+  int previous_first_ = 0;
+  int previous_second_ = 0;
+  int64_t num_repeats_ = 0;
+};
+
+/**
+ * How pixel accessors such as Image::GetRed and Image::SetColor check their
+ * arguments, chosen at compile time.
+ */
+enum class BoundsCheck {
+  // Checks coordinates and color values, printing a message and returning
+  // an error value if they are out of range. The default.
+  kChecked,
+  // Only asserts that arguments are in range, so release builds compiled
+  // with NDEBUG do no checks.
+  kAssert,
+  // No checks at all: each access is a plain load or store. Out of range
+  // arguments are undefined behavior.
+  kUnchecked,
+};
+
+/**
+ * A view of contiguous pixel values of one channel of an Image, like C++20's
+ * std::span: it can be indexed, and used in range-based for loops and with
+ * standard algorithms. Values are not bounds checked. A view is invalidated
+ * when the image is initialized or loaded again.
+ */
+template <typename T>
+class PixelSpan {
+ public:
+  PixelSpan() = default;
+  PixelSpan(T* data, size_t size) : data_(data), size_(size) {}
+
+  T* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  T& operator[](size_t index) const { return data_[index]; }
+  T* begin() const { return data_; }
+  T* end() const { return data_ + size_; }
+
+ private:
+  T* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+class InterleavedImage;
+
 class Image {
  public:
   Image();
@@ -180,55 +376,108 @@ class Image {
 
   /**
    * Gets the color at pixel at position (x, y) in the image.
-   * Returns (-1, -1, -1) if (x, y) is out of bounds.
-   */
-  Color GetColor(int x, int y) const;
+   * Returns black, (0, 0, 0), if (x, y) is out of bounds.
+   *
+   * This and the other pixel accessors below take an optional BoundsCheck,
+   * for example GetColor<BoundsCheck::kUnchecked>(x, y), to skip checks in
+   * loops over many pixels which are known to be in bounds.
+   */
+  template <BoundsCheck check = BoundsCheck::kChecked>
+  Color GetColor(int x, int y) const {
+    if (!PixelInBounds<check>(x, y)) return Color(0, 0, 0);
+    return Color(*PixelData(x, y, 0), *PixelData(x, y, 1),
+                 *PixelData(x, y, 2));
+  }
 
   /**
    * Returns the red component of the RGB pixel at position
    * (x, y) in the image. Returns -1 if (x, y) is out of bounds.
    */
-  int GetRed(int x, int y) const;
+  template <BoundsCheck check = BoundsCheck::kChecked>
+  int GetRed(int x, int y) const {
+    return GetPixel<check>(x, y, 0);
+  }
 
   /**
    * Returns the green component of the RGB pixel at position
    * (x, y) in the image. Returns -1 if (x, y) is out of bounds.
    */
-  int GetGreen(int x, int y) const;
+  template <BoundsCheck check = BoundsCheck::kChecked>
+  int GetGreen(int x, int y) const {
+    return GetPixel<check>(x, y, 1);
+  }
 
   /**
    * Returns the blue component of the RGB pixel at position
    * (x, y) in the image. Returns -1 if (x, y) is out of bounds.
    */
-  int GetBlue(int x, int y) const;
+  template <BoundsCheck check = BoundsCheck::kChecked>
+  int GetBlue(int x, int y) const {
+    return GetPixel<check>(x, y, 2);
+  }
 
   /**
    * Sets the color of the RGB pixel at position (x, y)
-   * in the image. Returns false if (x, y) is out of bounds or
-   * red, green or blue are out of range [0, 255].
-   */
-  bool SetColor(int x, int y, const Color& color);
+   * in the image. Returns false if (x, y) is out of bounds.
+   */
+  template <BoundsCheck check = BoundsCheck::kChecked>
+  bool SetColor(int x, int y, const Color& color) {
+    // Colors are always in range.
+    if (!PixelInBounds<check>(x, y)) return false;
+    *PixelData(x, y, 0) = static_cast<uint8_t>(color.Red());
+    *PixelData(x, y, 1) = static_cast<uint8_t>(color.Green());
+    *PixelData(x, y, 2) = static_cast<uint8_t>(color.Blue());
+    return true;
+  }
 
   /**
    * Sets the red component of the RGB pixel at position (x, y)
    * in the image. Returns false if (x, y) is out of bounds or
    * |r| is out of range [0, 255].
    */
-  bool SetRed(int x, int y, int r);
+  template <BoundsCheck check = BoundsCheck::kChecked>
+  bool SetRed(int x, int y, int r) {
+    return SetPixel<check>(x, y, 0, r);
+  }
 
   /**
    * Sets the green component of the RGB pixel at position (x, y)
    * in the image. Returns false if (x, y) is out of bounds or
    * |g| is out of range [0, 255].
    */
-  bool SetGreen(int x, int y, int g);
+  template <BoundsCheck check = BoundsCheck::kChecked>
+  bool SetGreen(int x, int y, int g) {
+    return SetPixel<check>(x, y, 1, g);
+  }
 
   /**
    * Sets the blue component of the RGB pixel at position (x, y)
    * in the image. Returns false if (x, y) is out of bounds or
    * |b| is out of range [0, 255].
    */
-  bool SetBlue(int x, int y, int b);
+  template <BoundsCheck check = BoundsCheck::kChecked>
+  bool SetBlue(int x, int y, int b) {
+    return SetPixel<check>(x, y, 2, b);
+  }
+
+  /**
+   * Returns a view of the |channel| values of row |y|, GetWidth() long,
+   * where index x is the pixel at (x, y). Checks bounds once for the whole
+   * row, rather than once per pixel like GetRed and SetRed, so loops over
+   * many pixels run much faster. Returns an empty view if |y| is out of
+   * bounds or the image has no such channel, such as a loaded grayscale
+   * image. Changes appear when the image is next shown or flushed.
+   */
+  PixelSpan<uint8_t> GetRow(int y, Channel channel);
+  PixelSpan<const uint8_t> GetRow(int y, Channel channel) const;
+
+  /**
+   * Returns a view of all the |channel| values, GetWidth() * GetHeight()
+   * long, in row-major order: index y * GetWidth() + x is the pixel at
+   * (x, y). Returns an empty view if the image has no such channel.
+   */
+  PixelSpan<uint8_t> GetPlane(Channel channel);
+  PixelSpan<const uint8_t> GetPlane(Channel channel) const;
 
   /**
    * Draws a line from (x0, y0) to (x1, y1) with color |color| and optional width |thickness|.
@@ -296,6 +545,35 @@ class Image {
   bool DrawText(int x, int y, const std::string& text, int font_size, int red,
                 int green, int blue);
 
+  /**
+   * Copies all of |image| into this image with its upper left corner at
+   * (x, y). Parts of |image| which fall outside of this image are skipped.
+   * Returns false if either image is invalid.
+   */
+  bool DrawImage(int x, int y, const Image& image) {
+    return DrawImage(x, y, image, 0, 0, image.GetWidth(), image.GetHeight());
+  }
+
+  /**
+   * Copies the |width| by |height| region of |image| with upper left corner
+   * at (image_x, image_y) into this image with its upper left corner at
+   * (x, y). The region is clipped to the bounds of both images, and may
+   * overlap when |image| is this image. Returns false if either image is
+   * invalid or this image is grayscale.
+   */
+  bool DrawImage(int x, int y, const Image& image, int image_x, int image_y,
+                 int width, int height);
+
+  /**
+   * Copies all of |image| into this image with its upper left corner at
+   * (x, y), skipping every pixel of |image| which is exactly
+   * |transparent_color|. Useful for drawing pre-rendered sprites. Parts of
+   * |image| which fall outside of this image are skipped. Returns false if
+   * either image is invalid or grayscale.
+   */
+  bool DrawImage(int x, int y, const Image& image,
+                 const Color& transparent_color);
+
   /**
    * Adds a MouseEventListener to this image. This MouseEventListener's OnMouseEvent
    * function will be called whenever the display receives left-button mouse
@@ -342,6 +620,7 @@ class Image {
 
  private:
   friend class TestEventGenerator;
+  friend class InterleavedImage;
 
   CImgDisplay* GetDisplayForTesting() {
     if (!display_) return nullptr;
@@ -360,13 +639,55 @@ class Image {
 
   bool CheckColorInBounds(const int value[]) const;
 
-  int GetPixel(int x, int y, int channel) const;
+  bool CheckChannelInBounds(Channel channel) const;
 
-  bool SetPixel(int x, int y, int channel, int value);
+  template <BoundsCheck check>
+  bool PixelInBounds(int x, int y) const {
+    if constexpr (check == BoundsCheck::kChecked) {
+      return CheckPixelInBounds(x, y);
+    } else if constexpr (check == BoundsCheck::kAssert) {
+      assert(x >= 0 && y >= 0 && x < width_ && y < height_ &&
+             "Pixel is out of bounds");
+    }
+    return true;
+  }
+
+  template <BoundsCheck check>
+  bool ColorInBounds(int value) const {
+    if constexpr (check == BoundsCheck::kChecked) {
+      return CheckColorInBounds(value);
+    } else if constexpr (check == BoundsCheck::kAssert) {
+      assert(value >= 0 && value <= 255 && "Color is out of range");
+    }
+    return true;
+  }
+
+  // The value of |channel| at (x, y), in CImg's planar layout.
+  uint8_t* PixelData(int x, int y, int channel) const {
+    return pixels_ + static_cast<size_t>(channel) * width_ * height_ +
+           static_cast<size_t>(y) * width_ + x;
+  }
+
+  template <BoundsCheck check>
+  int GetPixel(int x, int y, int channel) const {
+    if (!PixelInBounds<check>(x, y)) return -1;
+    return *PixelData(x, y, channel);
+  }
+
+  template <BoundsCheck check>
+  bool SetPixel(int x, int y, int channel, int value) {
+    if (!PixelInBounds<check>(x, y) || !ColorInBounds<check>(value)) {
+      return false;
+    }
+    *PixelData(x, y, channel) = static_cast<uint8_t>(value);
+    return true;
+  }
 
   int width_ = 0;
   int height_ = 0;
   std::unique_ptr<CImg<uint8_t>> cimage_;
+  // The start of |cimage_|'s pixel data, for inline accessors.
+  uint8_t* pixels_ = nullptr;
   std::unique_ptr<CImgDisplay> display_;
   int timer_ = 0;
 
@@ -379,6 +700,121 @@ class Image {
   MouseEvent latest_event_ = MouseEvent(0, 0, MouseAction::kReleased);
 };
 
+/**
+ * Byte layouts of interleaved pixel data: 3 or 4 bytes per pixel, in
+ * row-major order.
+ */
+enum class PixelFormat {
+  // Red, green and blue bytes.
+  kRGB,
+  // Red, green, blue and alpha bytes. Alpha is 255 on export and ignored on
+  // import.
+  kRGBA,
+};
+
+/**
+ * An image whose pixels are stored interleaved, one packed Color per pixel in
+ * row-major order, rather than in separate planes for each channel like
+ * Image. Reading or writing a whole pixel is a single 4-byte access, so it
+ * suits loops which process every pixel, and exporting to interleaved
+ * consumers such as encoders needs no transpose. Convert to an Image to
+ * draw shapes, show or save it.
+ */
+class InterleavedImage {
+ public:
+  InterleavedImage() = default;
+
+  /**
+   * Creates a blank white image of size |width| by |height|.
+   */
+  InterleavedImage(int width, int height);
+
+  /**
+   * Creates a copy of |image| with interleaved pixels. Grayscale images are
+   * copied into all three channels.
+   */
+  explicit InterleavedImage(const Image& image);
+
+  int GetWidth() const { return width_; }
+  int GetHeight() const { return height_; }
+
+  /**
+   * Gets the color of the pixel at (x, y), or black if it is out of bounds.
+   * Takes an optional BoundsCheck like Image::GetColor.
+   */
+  template <BoundsCheck check = BoundsCheck::kChecked>
+  Color GetColor(int x, int y) const {
+    if (!PixelInBounds<check>(x, y)) return Color(0, 0, 0);
+    return pixels_[static_cast<size_t>(y) * width_ + x];
+  }
+
+  /**
+   * Sets the color of the pixel at (x, y). Returns false if it is out of
+   * bounds.
+   */
+  template <BoundsCheck check = BoundsCheck::kChecked>
+  bool SetColor(int x, int y, const Color& color) {
+    if (!PixelInBounds<check>(x, y)) return false;
+    pixels_[static_cast<size_t>(y) * width_ + x] = color;
+    return true;
+  }
+
+  /**
+   * Returns a view of the colors in row |y|, or an empty view if |y| is out
+   * of bounds.
+   */
+  PixelSpan<Color> GetRow(int y);
+  PixelSpan<const Color> GetRow(int y) const;
+
+  /**
+   * Returns a view of all the colors in row-major order.
+   */
+  PixelSpan<Color> GetPixels() {
+    return PixelSpan<Color>(pixels_.data(), pixels_.size());
+  }
+  PixelSpan<const Color> GetPixels() const {
+    return PixelSpan<const Color>(pixels_.data(), pixels_.size());
+  }
+
+  /**
+   * Copies this image into |image|, resizing it if needed, for example to
+   * show or save it.
+   */
+  void CopyTo(Image* image) const;
+
+  /**
+   * Writes the pixels to |out| in |format|, which must have room for
+   * GetWidth() * GetHeight() pixels.
+   */
+  void Export(PixelFormat format, uint8_t* out) const;
+
+  /**
+   * Resizes the image to |width| by |height| and reads its pixels from |in|
+   * in |format|. Returns false if |width| or |height| are less than 1.
+   */
+  bool Import(PixelFormat format, int width, int height, const uint8_t* in);
+
+ private:
+  template <BoundsCheck check>
+  bool PixelInBounds(int x, int y) const {
+    if constexpr (check == BoundsCheck::kChecked) {
+      if (x < 0 || y < 0 || x >= width_ || y >= height_) {
+        ImageDiagnostics::GetInstance().Report(Violation::kPixelOutOfBounds,
+                                               x, y);
+        return false;
+      }
+    } else if constexpr (check == BoundsCheck::kAssert) {
+      assert(x >= 0 && y >= 0 && x < width_ && y < height_ &&
+             "Pixel is out of bounds");
+    }
+    return true;
+  }
+
+  int width_ = 0;
+  int height_ = 0;
+  std::vector<Color> pixels_;
+};
+
 }  // namespace graphics
 
 #endif  // GRAPHICS_IMAGE_H
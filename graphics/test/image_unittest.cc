@@ -9,7 +9,9 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #include "image_test_utils.h"
 #include "test_event_generator.h"
@@ -56,6 +58,12 @@ TEST(ImageDeathTest, InvalidSizeConstructorNegative) {
   ASSERT_DEATH(graphics::Image image(10, -1), "");
 }
 
+TEST(ImageDeathTest, AssertsPixelInBounds) {
+  graphics::Image image(10, 10);
+  ASSERT_DEATH(image.GetRed<graphics::BoundsCheck::kAssert>(10, 0), "");
+  ASSERT_DEATH(image.SetBlue<graphics::BoundsCheck::kAssert>(0, 0, 256), "");
+}
+
 TEST(ColorTest, ColorOperators) {
   graphics::Color black(0, 0, 0);
   graphics::Color red(255, 0, 0);
@@ -70,6 +78,21 @@ TEST(ColorTest, ColorOperators) {
   ASSERT_EQ(red.Blue(), 255);
 }
 
+TEST(ColorTest, PacksChannels) {
+  constexpr graphics::Color kColor(10, 20, 30);
+  static_assert(kColor.Green() == 20, "Colors are constexpr");
+  static_assert(sizeof(graphics::Color) == 4, "Colors are packed");
+  EXPECT_EQ(0xff1e140au, kColor.GetRGBA());
+  EXPECT_EQ(kColor, graphics::Color::FromRGBA(0x001e140a));
+
+  // Out of range values become 0, as in the constructor.
+  graphics::Color color(300, -1, 255);
+  EXPECT_EQ(graphics::Color(0, 0, 255), color);
+  color.SetRed(256);
+  color.SetGreen(7);
+  EXPECT_EQ(graphics::Color(0, 7, 255), color);
+}
+
 TEST(ImageTest, BlankImageCreation) {
   // Check size is correct.
   graphics::Image image(10, 10);
@@ -274,6 +297,267 @@ TEST(ImageTest, DrawsLinesWithThicknessOrderDoesntMatter) {
                           DiffType::kTypeHighlight));
 }
 
+TEST(ImageTest, DrawsImage) {
+  graphics::Color white(255, 255, 255);
+  graphics::Color blue(0, 0, 255);
+  graphics::Color red(255, 0, 0);
+  graphics::Image source(20, 10);
+  source.DrawRectangle(0, 0, 10, 10, blue);
+  source.DrawRectangle(10, 0, 10, 10, red);
+
+  graphics::Image image(30, 30);
+  EXPECT_TRUE(image.DrawImage(5, 5, source));
+  EXPECT_EQ(image.GetColor(4, 5), white);
+  EXPECT_EQ(image.GetColor(5, 5), blue);
+  EXPECT_EQ(image.GetColor(14, 14), blue);
+  EXPECT_EQ(image.GetColor(15, 14), red);
+  EXPECT_EQ(image.GetColor(24, 14), red);
+  EXPECT_EQ(image.GetColor(25, 14), white);
+  EXPECT_EQ(image.GetColor(15, 15), white);
+
+  // Copies just a region.
+  EXPECT_TRUE(image.DrawImage(0, 20, source, 8, 2, 4, 3));
+  EXPECT_EQ(image.GetColor(0, 20), blue);
+  EXPECT_EQ(image.GetColor(1, 22), blue);
+  EXPECT_EQ(image.GetColor(2, 20), red);
+  EXPECT_EQ(image.GetColor(3, 22), red);
+  EXPECT_EQ(image.GetColor(4, 20), white);
+  EXPECT_EQ(image.GetColor(0, 23), white);
+
+  // Regions are clipped to both images.
+  EXPECT_TRUE(image.DrawImage(-15, 25, source));
+  EXPECT_EQ(image.GetColor(0, 25), red);
+  EXPECT_EQ(image.GetColor(4, 29), red);
+  EXPECT_EQ(image.GetColor(5, 29), white);
+
+  // Cannot draw from an invalid image.
+  graphics::Image invalid;
+  EXPECT_FALSE(image.DrawImage(0, 0, invalid));
+}
+
+TEST(ImageTest, DrawsImageOntoItself) {
+  graphics::Color white(255, 255, 255);
+  graphics::Color blue(0, 0, 255);
+  graphics::Color red(255, 0, 0);
+  graphics::Image image(10, 10);
+  image.SetColor(2, 2, blue);
+  image.SetColor(2, 3, red);
+
+  // Overlapping regions are copied as if from an unchanged source.
+  EXPECT_TRUE(image.DrawImage(2, 3, image, 2, 2, 1, 3));
+  EXPECT_EQ(image.GetColor(2, 3), blue);
+  EXPECT_EQ(image.GetColor(2, 4), red);
+  EXPECT_EQ(image.GetColor(2, 5), white);
+  EXPECT_TRUE(image.DrawImage(0, 0, image, 0, 1, 10, 9));
+  EXPECT_EQ(image.GetColor(2, 2), blue);
+  EXPECT_EQ(image.GetColor(2, 3), red);
+  EXPECT_EQ(image.GetColor(2, 4), white);
+}
+
+TEST(ImageTest, DoesNotDrawOntoGrayscaleImage) {
+  std::string filename = "test_gray.pgm";
+  FILE* file = fopen(filename.c_str(), "wb");
+  ASSERT_NE(nullptr, file);
+  fputs("P5\n4 4\n255\n", file);
+  for (int i = 0; i < 16; i++) fputc(128, file);
+  fclose(file);
+  graphics::Image gray;
+  ASSERT_TRUE(gray.Load(filename));
+  remove(filename.c_str());
+
+  // The destination needs all three channels.
+  graphics::Image source(4, 4);
+  EXPECT_FALSE(gray.DrawImage(0, 0, source, 0, 0, 4, 4));
+  EXPECT_FALSE(gray.DrawImage(0, 0, source, graphics::Color(1, 2, 3)));
+
+  // Drawing from a grayscale image still works.
+  EXPECT_TRUE(source.DrawImage(0, 0, gray, 0, 0, 2, 2));
+  EXPECT_EQ(graphics::Color(128, 128, 128), source.GetColor(1, 1));
+}
+
+TEST(ImageTest, DrawsImageWithTransparentColor) {
+  graphics::Color white(255, 255, 255);
+  graphics::Color blue(0, 0, 255);
+  graphics::Color green(0, 255, 0);
+  graphics::Color transparent(255, 0, 255);
+  graphics::Image sprite(10, 10);
+  sprite.DrawRectangle(0, 0, 10, 10, transparent);
+  sprite.DrawRectangle(3, 3, 4, 4, blue);
+
+  graphics::Image image(20, 20);
+  image.DrawRectangle(0, 0, 20, 20, green);
+  EXPECT_TRUE(image.DrawImage(5, 5, sprite, transparent));
+  EXPECT_EQ(image.GetColor(5, 5), green);
+  EXPECT_EQ(image.GetColor(7, 7), green);
+  EXPECT_EQ(image.GetColor(8, 8), blue);
+  EXPECT_EQ(image.GetColor(11, 11), blue);
+  EXPECT_EQ(image.GetColor(12, 12), green);
+
+  // Sprites are clipped at the image edges.
+  EXPECT_TRUE(image.DrawImage(-5, 15, sprite, transparent));
+  EXPECT_EQ(image.GetColor(0, 18), blue);
+  EXPECT_EQ(image.GetColor(1, 19), blue);
+  EXPECT_EQ(image.GetColor(2, 19), green);
+}
+
+TEST(ImageTest, AccessesPixelsWithBoundsCheckPolicies) {
+  using graphics::BoundsCheck;
+  graphics::Image image(10, 10);
+  graphics::Color color(10, 20, 30);
+  EXPECT_TRUE(image.SetColor<BoundsCheck::kUnchecked>(3, 4, color));
+  EXPECT_EQ(color, image.GetColor<BoundsCheck::kUnchecked>(3, 4));
+  EXPECT_EQ(color, image.GetColor<BoundsCheck::kAssert>(3, 4));
+  EXPECT_EQ(color, image.GetColor(3, 4));
+
+  EXPECT_TRUE(image.SetRed<BoundsCheck::kAssert>(9, 9, 1));
+  EXPECT_TRUE(image.SetGreen<BoundsCheck::kUnchecked>(9, 9, 2));
+  EXPECT_TRUE(image.SetBlue<BoundsCheck::kChecked>(9, 9, 3));
+  EXPECT_EQ(1, image.GetRed<BoundsCheck::kUnchecked>(9, 9));
+  EXPECT_EQ(2, image.GetGreen<BoundsCheck::kAssert>(9, 9));
+  EXPECT_EQ(3, image.GetBlue<BoundsCheck::kChecked>(9, 9));
+
+  // The default checks arguments.
+  EXPECT_FALSE(image.SetColor(10, 0, color));
+  EXPECT_FALSE(image.SetRed(0, 0, 256));
+  EXPECT_EQ(-1, image.GetGreen(0, -1));
+  EXPECT_EQ(255, image.GetRed(0, 0));
+}
+
+class TestDiagnosticsSink : public graphics::DiagnosticsSink {
+ public:
+  void Write(const std::string& line) override { lines.push_back(line); }
+
+  std::vector<std::string> lines;
+};
+
+TEST(ImageTest, LimitsDiagnostics) {
+  using graphics::ImageDiagnostics;
+  using graphics::Violation;
+  ImageDiagnostics& diagnostics = ImageDiagnostics::GetInstance();
+  TestDiagnosticsSink sink;
+  diagnostics.Reset();
+  diagnostics.SetSink(&sink);
+  diagnostics.SetMaxMessages(3);
+
+  graphics::Image image(10, 10);
+  // Repeats are only written once.
+  for (int i = 0; i < 5; i++) {
+    EXPECT_FALSE(image.SetRed(0, 0, 300));
+  }
+  ASSERT_EQ(1, sink.lines.size());
+  EXPECT_EQ("300 is out of range, must be between 0 and 255.", sink.lines[0]);
+
+  // Only the first messages are written.
+  for (int x = 10; x < 1000; x++) {
+    EXPECT_EQ(-1, image.GetGreen(x, 0));
+  }
+  ASSERT_EQ(4, sink.lines.size());
+  EXPECT_EQ("(Repeated 4 more times.)", sink.lines[1]);
+  EXPECT_EQ("(10, 0) is out of bounds.", sink.lines[2]);
+  EXPECT_EQ("(11, 0) is out of bounds.", sink.lines[3]);
+  EXPECT_EQ(990, diagnostics.GetCount(Violation::kPixelOutOfBounds));
+  EXPECT_EQ(5, diagnostics.GetCount(Violation::kColorOutOfRange));
+  EXPECT_EQ(0, diagnostics.GetCount(Violation::kMissingChannel));
+
+  // Then a summary.
+  diagnostics.Flush();
+  ASSERT_EQ(5, sink.lines.size());
+  EXPECT_EQ(
+      "988 more image errors were not shown. In total: 990 pixels out of "
+      "bounds, 5 colors out of range, 0 missing channels.",
+      sink.lines[4]);
+
+  diagnostics.SetSink(nullptr);
+  diagnostics.SetMaxMessages(ImageDiagnostics::kDefaultMaxMessages);
+  diagnostics.Reset();
+}
+
+TEST(ImageTest, AccessesRowsAndPlanes) {
+  graphics::Image image(20, 10);
+  image.DrawRectangle(0, 3, 20, 1, 10, 20, 30);
+
+  graphics::PixelSpan<uint8_t> row = image.GetRow(3, graphics::Channel::kGreen);
+  ASSERT_EQ(20, row.size());
+  for (uint8_t value : row) {
+    EXPECT_EQ(20, value);
+  }
+  row[5] = 99;
+  EXPECT_EQ(99, image.GetGreen(5, 3));
+  EXPECT_EQ(10, image.GetRed(5, 3));
+
+  graphics::PixelSpan<uint8_t> plane = image.GetPlane(graphics::Channel::kBlue);
+  ASSERT_EQ(200, plane.size());
+  EXPECT_EQ(255, plane[2 * 20 + 5]);
+  EXPECT_EQ(30, plane[3 * 20 + 5]);
+  std::fill(plane.begin(), plane.end(), 7);
+  EXPECT_EQ(graphics::Color(255, 255, 7), image.GetColor(19, 9));
+
+  const graphics::Image& const_image = image;
+  EXPECT_EQ(7, const_image.GetRow(9, graphics::Channel::kBlue)[0]);
+  EXPECT_EQ(200, const_image.GetPlane(graphics::Channel::kRed).size());
+
+  // Bounds are checked once per view.
+  EXPECT_TRUE(image.GetRow(-1, graphics::Channel::kRed).empty());
+  EXPECT_TRUE(image.GetRow(10, graphics::Channel::kRed).empty());
+  graphics::Image invalid;
+  EXPECT_TRUE(invalid.GetPlane(graphics::Channel::kRed).empty());
+}
+
+TEST(InterleavedImageTest, ConvertsToAndFromPlanar) {
+  graphics::Image image(7, 5);
+  image.DrawRectangle(2, 1, 3, 2, 10, 20, 30);
+  image.SetColor(6, 4, graphics::Color(1, 2, 3));
+
+  graphics::InterleavedImage interleaved(image);
+  ASSERT_EQ(7, interleaved.GetWidth());
+  ASSERT_EQ(5, interleaved.GetHeight());
+  for (int y = 0; y < 5; y++) {
+    for (int x = 0; x < 7; x++) {
+      EXPECT_EQ(image.GetColor(x, y), interleaved.GetColor(x, y));
+    }
+  }
+  EXPECT_EQ(graphics::Color(10, 20, 30), interleaved.GetRow(2)[4]);
+  EXPECT_EQ(35, interleaved.GetPixels().size());
+
+  EXPECT_TRUE(interleaved.SetColor(0, 0, graphics::Color(4, 5, 6)));
+  EXPECT_FALSE(interleaved.SetColor(7, 0, graphics::Color(4, 5, 6)));
+  EXPECT_TRUE(interleaved.GetRow(5).empty());
+  graphics::Image copy;
+  interleaved.CopyTo(&copy);
+  ASSERT_EQ(7, copy.GetWidth());
+  EXPECT_EQ(graphics::Color(4, 5, 6), copy.GetColor(0, 0));
+  EXPECT_EQ(graphics::Color(10, 20, 30), copy.GetColor(3, 1));
+  EXPECT_EQ(graphics::Color(1, 2, 3), copy.GetColor(6, 4));
+  EXPECT_EQ(graphics::Color(255, 255, 255), copy.GetColor(6, 3));
+
+  graphics::InterleavedImage blank(2, 1);
+  EXPECT_EQ(graphics::Color(255, 255, 255), blank.GetColor(1, 0));
+}
+
+TEST(InterleavedImageTest, ExportsAndImportsBytes) {
+  graphics::InterleavedImage image(2, 1);
+  image.SetColor(0, 0, graphics::Color(1, 2, 3));
+  image.SetColor(1, 0, graphics::Color(4, 5, 6));
+
+  std::vector<uint8_t> rgb(6);
+  image.Export(graphics::PixelFormat::kRGB, rgb.data());
+  EXPECT_EQ(std::vector<uint8_t>({1, 2, 3, 4, 5, 6}), rgb);
+  std::vector<uint8_t> rgba(8);
+  image.Export(graphics::PixelFormat::kRGBA, rgba.data());
+  EXPECT_EQ(std::vector<uint8_t>({1, 2, 3, 255, 4, 5, 6, 255}), rgba);
+
+  const uint8_t pixels[] = {7, 8, 9, 0, 10, 11, 12, 0, 13, 14, 15, 0};
+  ASSERT_TRUE(image.Import(graphics::PixelFormat::kRGBA, 1, 3, pixels));
+  EXPECT_EQ(1, image.GetWidth());
+  EXPECT_EQ(3, image.GetHeight());
+  EXPECT_EQ(graphics::Color(7, 8, 9), image.GetColor(0, 0));
+  EXPECT_EQ(graphics::Color(13, 14, 15), image.GetColor(0, 2));
+  ASSERT_TRUE(image.Import(graphics::PixelFormat::kRGB, 2, 2, pixels));
+  EXPECT_EQ(graphics::Color(0, 10, 11), image.GetColor(1, 0));
+  EXPECT_EQ(graphics::Color(14, 15, 0), image.GetColor(1, 1));
+  EXPECT_FALSE(image.Import(graphics::PixelFormat::kRGB, 0, 2, pixels));
+}
+
 class TestEventListener : public graphics::MouseEventListener {
  public:
   TestEventListener() = default;
@@ -106,6 +106,16 @@ void Finish() {
   r.Finish();
 }
 
+void EnableTurboMode() {
+  karel::Robot& r = karel::Robot::GetInstance();
+  r.EnableTurboMode();
+}
+
+void SetSpeed(double speed) {
+  karel::Robot& r = karel::Robot::GetInstance();
+  r.SetSpeed(speed);
+}
+
 void EnableCSVOutput() {
   karel::Robot& r = karel::Robot::GetInstance();
   r.EnableCSVOutput();
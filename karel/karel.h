@@ -150,6 +150,19 @@ void LoadWorld(std::string filename);
  */
 void Finish();
 
+/**
+ * Speeds up watching long programs. Karel's world is shown at most once per
+ * screen refresh instead of pausing after every action, and Move is not
+ * animated between cells.
+ */
+void EnableTurboMode();
+
+/**
+ * Sets how fast Karel is animated, overriding the world file's Speed. 1 is
+ * the default speed, 2 is twice as fast and 0.5 is half as fast.
+ */
+void SetSpeed(double speed);
+
 /////////////////////////////////////////////////////////////////////////////
 // Methods for improving the accessibility of Karel                        //
 /////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,109 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "batch_runner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "robot.h"
+
+namespace karel {
+
+namespace {
+
+// Makes a robot the current instance until it goes out of scope, however
+// the run ends.
+class CurrentInstanceGuard {
+ public:
+  explicit CurrentInstanceGuard(Robot* robot) {
+    Robot::SetCurrentInstance(robot);
+  }
+  ~CurrentInstanceGuard() { Robot::SetCurrentInstance(nullptr); }
+
+  CurrentInstanceGuard(const CurrentInstanceGuard&) = delete;
+  CurrentInstanceGuard& operator=(const CurrentInstanceGuard&) = delete;
+};
+
+// Runs |program| in the world in |result.filename| and fills in |result|.
+void RunOne(const std::function<void()>& program,
+            const std::function<void(const Robot&, const BatchResult&)>&
+                on_finished,
+            BatchResult* result) {
+  Robot robot;
+  CurrentInstanceGuard guard(&robot);
+  try {
+    robot.LoadWorld(result->filename, /* enable graphics */ false);
+  } catch (std::string error) {
+    result->load_error = error;
+    return;
+  }
+  // Anything else escaping would end the worker thread and with it the
+  // whole batch, so it is recorded for this world instead.
+  try {
+    program();
+  } catch (RobotError) {
+    // A step budget or loop detection stopped the program; the error is
+    // already recorded on the robot.
+  } catch (const std::exception& exception) {
+    result->program_error =
+        std::string("Program threw an exception: ") + exception.what();
+  } catch (...) {
+    result->program_error = "Program threw an exception";
+  }
+  result->error = robot.GetError();
+  result->x = robot.GetXPosition();
+  result->y = robot.GetYPosition();
+  result->orientation = robot.GetOrientation();
+  result->beepers_in_bag = robot.GetNumBeepersInBag();
+  result->num_actions = robot.GetNumActions();
+  if (on_finished) {
+    on_finished(robot, *result);
+  }
+}
+
+}  // namespace
+
+std::vector<BatchResult> RunBatch(
+    const std::function<void()>& program,
+    const std::vector<std::string>& filenames, int num_threads,
+    const std::function<void(const Robot&, const BatchResult&)>&
+        on_finished) {
+  std::vector<BatchResult> results(filenames.size());
+  for (size_t i = 0; i < filenames.size(); i++) {
+    results[i].filename = filenames[i];
+  }
+  if (num_threads <= 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  num_threads = std::min<size_t>(num_threads, filenames.size());
+
+  // Workers take the next world as soon as they finish one, so a few slow
+  // worlds don't hold up the rest.
+  std::atomic<size_t> next_world(0);
+  auto worker = [&]() {
+    for (size_t i = next_world++; i < results.size(); i = next_world++) {
+      RunOne(program, on_finished, &results[i]);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int i = 1; i < num_threads; i++) {
+    threads.push_back(std::thread(worker));
+  }
+  // The calling thread works too.
+  worker();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  return results;
+}
+
+}  // namespace karel
@@ -0,0 +1,74 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "error.h"
+#include "orientation.h"
+#include "robot.h"
+
+#ifndef BATCH_RUNNER_H
+#define BATCH_RUNNER_H
+
+namespace karel {
+
+/**
+ * The final state of a Karel program run in one world.
+ */
+struct BatchResult {
+  // The world file the program ran in.
+  std::string filename;
+
+  // Why the world could not be loaded, or empty if it loaded. When set the
+  // program was not run and the rest of the result is not meaningful.
+  std::string load_error;
+
+  // Karel's final error state.
+  RobotError error = RobotError::kNoError;
+
+  // Why the program stopped by throwing an exception other than a
+  // RobotError, or empty if it did not. The rest of the result is Karel's
+  // state when it threw.
+  std::string program_error;
+
+  // Karel's final position in grid coordinates, where (1, 1) is the bottom
+  // left cell, and orientation.
+  int x = 0;
+  int y = 0;
+  Orientation orientation = Orientation::kNorth;
+
+  // Beepers left in Karel's bag.
+  int beepers_in_bag = 0;
+
+  // Number of actions (Move, TurnLeft, PutBeeper, PickBeeper) Karel took.
+  int64_t num_actions = 0;
+};
+
+/**
+ * Runs |program| once in each of the world files in |filenames|, headless,
+ * spreading the worlds across |num_threads| threads (or one per core if
+ * |num_threads| is 0). |program| should use the Karel functions in karel.h,
+ * which are bound to a separate Robot for each world.
+ *
+ * If |on_finished| is set it is called on the worker thread after each run,
+ * while the robot is still available, for example to inspect the final
+ * world.
+ *
+ * Returns one result per world, in the same order as |filenames|.
+ */
+std::vector<BatchResult> RunBatch(
+    const std::function<void()>& program,
+    const std::vector<std::string>& filenames, int num_threads = 0,
+    const std::function<void(const Robot&, const BatchResult&)>& on_finished =
+        nullptr);
+
+}  // namespace karel
+
+#endif  // BATCH_RUNNER_H
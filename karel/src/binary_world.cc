@@ -0,0 +1,262 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "binary_world.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+
+#include "cell.h"
+#include "orientation.h"
+#include "robot.h"
+#include "world.h"
+
+namespace karel {
+
+namespace {
+
+const char kMagic[] = {'K', 'R', 'L', 'W'};
+const uint32_t kVersion = 1;
+
+// Magic, version, six int32 fields and the speed.
+const size_t kHeaderSize = 4 + 4 + 6 * 4 + 8;
+
+void PutUint32(uint32_t value, std::string* out) {
+  for (int i = 0; i < 4; i++) {
+    out->push_back(static_cast<char>(value >> (8 * i)));
+  }
+}
+
+void PutVarint(uint64_t value, std::string* out) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+// Reads from a binary world, failing once the data runs out.
+class Decoder {
+ public:
+  Decoder(const char* data, size_t size)
+      : position_(reinterpret_cast<const uint8_t*>(data)),
+        end_(position_ + size) {}
+
+  bool GetUint32(uint32_t* value) {
+    if (end_ - position_ < 4) return false;
+    *value = 0;
+    for (int i = 0; i < 4; i++) {
+      *value |= static_cast<uint32_t>(position_[i]) << (8 * i);
+    }
+    position_ += 4;
+    return true;
+  }
+
+  bool GetInt32(int* value) {
+    uint32_t bits;
+    if (!GetUint32(&bits)) return false;
+    *value = static_cast<int32_t>(bits);
+    return true;
+  }
+
+  bool GetVarint(uint64_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64 && position_ < end_; shift += 7) {
+      uint8_t byte = *position_++;
+      *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) return true;
+    }
+    return false;
+  }
+
+  // Returns the next |size| bytes, or nullptr if there are not enough.
+  const uint8_t* GetBytes(size_t size) {
+    if (static_cast<size_t>(end_ - position_) < size) return nullptr;
+    const uint8_t* bytes = position_;
+    position_ += size;
+    return bytes;
+  }
+
+  size_t GetRemaining() const { return end_ - position_; }
+
+ private:
+  const uint8_t* position_;
+  const uint8_t* end_;
+};
+
+}  // namespace
+
+bool IsBinaryWorld(const char* data, size_t size) {
+  return size >= sizeof(kMagic) && memcmp(data, kMagic, sizeof(kMagic)) == 0;
+}
+
+std::string EncodeBinaryWorld(const World& world,
+                              const BinaryWorldHeader& header) {
+  int width = world.GetWidth();
+  int height = world.GetHeight();
+  size_t num_cells = static_cast<size_t>(width) * height;
+  std::string out(kMagic, sizeof(kMagic));
+  out.reserve(kHeaderSize + (num_cells + 1) / 2);
+  PutUint32(kVersion, &out);
+  PutUint32(width, &out);
+  PutUint32(height, &out);
+  PutUint32(header.beepers_in_bag, &out);
+  PutUint32(header.karel.x, &out);
+  PutUint32(header.karel.y, &out);
+  PutUint32(header.karel.orientation, &out);
+  uint64_t speed_bits;
+  static_assert(sizeof(speed_bits) == sizeof(header.speed),
+                "Speed must be a 64-bit double");
+  memcpy(&speed_bits, &header.speed, sizeof(speed_bits));
+  PutUint32(static_cast<uint32_t>(speed_bits), &out);
+  PutUint32(static_cast<uint32_t>(speed_bits >> 32), &out);
+
+  // Walls, two cells per byte.
+  uint8_t packed = 0;
+  size_t index = 0;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      Cell cell = world.GetCell(x, y);
+      uint8_t walls = 0;
+      for (int o = Orientation::kNorth; o <= Orientation::kWest; o++) {
+        if (cell.HasWall(static_cast<Orientation>(o))) walls |= 1 << o;
+      }
+      packed |= walls << (4 * (index % 2));
+      if (index % 2 == 1) {
+        out.push_back(static_cast<char>(packed));
+        packed = 0;
+      }
+      index++;
+    }
+  }
+  if (num_cells % 2 == 1) {
+    out.push_back(static_cast<char>(packed));
+  }
+
+  // Runs of equal beeper counts.
+  uint64_t run_length = 0;
+  int run_beepers = 0;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      int beepers = world.GetCell(x, y).GetNumBeepers();
+      if (run_length > 0 && beepers != run_beepers) {
+        PutVarint(run_length, &out);
+        PutVarint(run_beepers, &out);
+        run_length = 0;
+      }
+      run_beepers = beepers;
+      run_length++;
+    }
+  }
+  PutVarint(run_length, &out);
+  PutVarint(run_beepers, &out);
+  return out;
+}
+
+bool DecodeBinaryWorld(const char* data, size_t size, WorldStorage storage,
+                       World* world, BinaryWorldHeader* header,
+                       std::string* error) {
+  Decoder decoder(data, size);
+  uint32_t version;
+  int width, height, orientation;
+  uint32_t speed_low, speed_high;
+  if (!IsBinaryWorld(data, size) || !decoder.GetBytes(sizeof(kMagic)) ||
+      !decoder.GetUint32(&version) || !decoder.GetInt32(&width) ||
+      !decoder.GetInt32(&height) ||
+      !decoder.GetInt32(&header->beepers_in_bag) ||
+      !decoder.GetInt32(&header->karel.x) ||
+      !decoder.GetInt32(&header->karel.y) ||
+      !decoder.GetInt32(&orientation) || !decoder.GetUint32(&speed_low) ||
+      !decoder.GetUint32(&speed_high)) {
+    *error = "Binary world header is incomplete";
+    return false;
+  }
+  if (version != kVersion) {
+    *error = "Unsupported binary world version " + std::to_string(version);
+    return false;
+  }
+  if (width < 1 || height < 1) {
+    *error =
+        "Cannot load a world less than 1 cell wide or less than 1 cell tall";
+    return false;
+  }
+  size_t num_cells = static_cast<size_t>(width) * height;
+  // Check the walls are all there before allocating the world.
+  const uint8_t* walls = decoder.GetBytes((num_cells + 1) / 2);
+  if (walls == nullptr) {
+    *error = "Binary world walls are incomplete";
+    return false;
+  }
+  if (header->karel.x < 0 || header->karel.x >= width ||
+      header->karel.y < 0 || header->karel.y >= height ||
+      orientation < Orientation::kNorth || orientation > Orientation::kWest) {
+    *error = "Karel is not in the binary world";
+    return false;
+  }
+  header->karel.orientation = static_cast<Orientation>(orientation);
+  if (header->beepers_in_bag < -1) {
+    *error = "Binary world beeper bag count " +
+             std::to_string(header->beepers_in_bag) + " is invalid";
+    return false;
+  }
+  uint64_t speed_bits = static_cast<uint64_t>(speed_high) << 32 | speed_low;
+  memcpy(&header->speed, &speed_bits, sizeof(header->speed));
+  // Like the Speed: line in text worlds. Speeds below the minimum are raised
+  // by the Robot.
+  if (!isfinite(header->speed) || header->speed < 0) {
+    *error = "Binary world speed must be a number greater than 0";
+    return false;
+  }
+
+  world->Reset(width, height, storage);
+  size_t index = 0;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      uint8_t mask = walls[index / 2] >> (4 * (index % 2));
+      for (int o = Orientation::kNorth; o <= Orientation::kWest; o++) {
+        if (mask & (1 << o)) world->AddWall(x, y, static_cast<Orientation>(o));
+      }
+      index++;
+    }
+  }
+
+  index = 0;
+  while (index < num_cells) {
+    uint64_t run_length, beepers;
+    if (!decoder.GetVarint(&run_length) || !decoder.GetVarint(&beepers) ||
+        run_length == 0 || run_length > num_cells - index) {
+      *error = "Binary world beepers are incomplete";
+      return false;
+    }
+    if (beepers > Cell::kMaxBeepers) {
+      *error = "Too many beepers in binary world";
+      return false;
+    }
+    if (beepers > 0) {
+      for (size_t end = index + run_length; index < end; index++) {
+        world->SetNumBeepers(index % width, index / width,
+                             static_cast<int>(beepers));
+      }
+    } else {
+      // Cells start empty.
+      index += run_length;
+    }
+  }
+  return true;
+}
+
+void ConvertToBinaryWorld(const std::string& world_filename,
+                          const std::string& binary_filename) {
+  Robot robot;
+  robot.LoadWorld(world_filename, /* enable graphics */ false);
+  robot.SaveWorldBinary(binary_filename);
+}
+
+}  // namespace karel
@@ -0,0 +1,73 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <stddef.h>
+
+#include <string>
+
+#include "orientation.h"
+#include "world.h"
+
+#ifndef BINARY_WORLD_H
+#define BINARY_WORLD_H
+
+namespace karel {
+
+/**
+ * The state stored alongside the cells in a binary world.
+ */
+struct BinaryWorldHeader {
+  // Karel's position in world coordinates, where (0, 0) is the top left
+  // cell, and orientation.
+  PositionAndOrientation karel;
+  int beepers_in_bag = 0;
+  double speed = 1.0;
+};
+
+// A compact binary alternative to the text .w format, for large worlds
+// which are loaded many times. All integers are little-endian.
+//
+//   magic "KRLW", uint32 version
+//   int32 width, int32 height
+//   int32 bag, int32 karel x, int32 karel y, int32 karel orientation
+//   float64 speed
+//   walls: one 4-bit mask per cell, bit n for Orientation n, two cells per
+//          byte with the first cell in the low bits, row-major
+//   beepers: runs of varint (number of cells, beepers per cell) covering
+//            every cell in row-major order
+
+/**
+ * Returns true if |data| starts with the binary world magic number.
+ */
+bool IsBinaryWorld(const char* data, size_t size);
+
+/**
+ * Encodes |world| and |header| in the binary world format.
+ */
+std::string EncodeBinaryWorld(const World& world,
+                              const BinaryWorldHeader& header);
+
+/**
+ * Decodes the |size| bytes of a binary world at |data| into |world|, using
+ * |storage|, and |header|. Returns false and sets |error| if the data is not
+ * a valid binary world, including a bag of fewer than -1 beepers or a
+ * negative or non-finite speed.
+ */
+bool DecodeBinaryWorld(const char* data, size_t size, WorldStorage storage,
+                       World* world, BinaryWorldHeader* header,
+                       std::string* error);
+
+/**
+ * Converts the text world file |world_filename| to a binary world file.
+ * Throws a std::string if the text world cannot be loaded or the binary
+ * world cannot be written.
+ */
+void ConvertToBinaryWorld(const std::string& world_filename,
+                          const std::string& binary_filename);
+
+}  // namespace karel
+
+#endif  // BINARY_WORLD_H
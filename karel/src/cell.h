@@ -4,6 +4,8 @@
 // license that can be found in the LICENSE file or at
 // https://opensource.org/licenses/MIT.
 
+#include <stdint.h>
+
 #include "orientation.h"
 
 #ifndef CELL_H
@@ -13,17 +15,53 @@ namespace karel {
 
 /**
  * Class representing a cell in Karel's world, including a count of beepers
- * and whether or not there are walls.
+ * and whether or not there are walls. Packed into 32 bits so that large
+ * worlds stay small in memory.
  */
 class Cell {
  public:
-  int GetNumBeepers() const { return num_beepers_; }
-  void SetNumBeepers(int beepers) { num_beepers_ = beepers; }
+  // The largest number of beepers a cell can hold.
+  static constexpr int kMaxBeepers = (1 << 24) - 1;
+
+  int GetNumBeepers() const { return static_cast<int>(bits_ >> kBeeperShift); }
+
+  /**
+   * Sets the number of beepers in the cell. Counts are clamped to the range
+   * [0, kMaxBeepers], so callers which must not lose beepers check the limit
+   * first.
+   */
+  void SetNumBeepers(int beepers) {
+    if (beepers < 0) beepers = 0;
+    if (beepers > kMaxBeepers) beepers = kMaxBeepers;
+    bits_ = (bits_ & kFlagMask) |
+            (static_cast<uint32_t>(beepers) << kBeeperShift);
+  }
+
+  bool HasNorthWall() const { return HasWall(kNorth); }
+  bool HasEastWall() const { return HasWall(kEast); }
+  bool HasSouthWall() const { return HasWall(kSouth); }
+  bool HasWestWall() const { return HasWall(kWest); }
+
+  // Returns true if there is a wall on the |wall_orientation| side.
+  bool HasWall(Orientation wall_orientation) const {
+    return bits_ & (1u << wall_orientation);
+  }
 
-  bool HasNorthWall() const { return north_wall_; }
-  bool HasEastWall() const { return east_wall_; }
-  bool HasSouthWall() const { return south_wall_; }
-  bool HasWestWall() const { return west_wall_; }
+  /**
+   * Returns true if Karel cannot leave the cell in |direction|, because of a
+   * wall on either side of the edge or the edge of the world.
+   */
+  bool IsBlocked(Orientation direction) const {
+    return bits_ & (1u << (kBlockedShift + direction));
+  }
+
+  /**
+   * Marks the cell as blocked in |direction|. Walls do not block by
+   * themselves: the World blocks both cells sharing a wall.
+   */
+  void Block(Orientation direction) {
+    bits_ |= 1u << (kBlockedShift + direction);
+  }
 
   /**
    * Adds a wall on the given side of the cell. For example, a north wall would
@@ -31,28 +69,20 @@ class Cell {
    * cell.
    */
   void AddWall(Orientation wall_orientation) {
-    switch (wall_orientation) {
-      case kNorth:
-        north_wall_ = true;
-        break;
-      case kEast:
-        east_wall_ = true;
-        break;
-      case kSouth:
-        south_wall_ = true;
-        break;
-      case kWest:
-        west_wall_ = true;
-        break;
-    }
+    bits_ |= 1u << wall_orientation;
   }
 
+  bool operator==(const Cell& other) const { return bits_ == other.bits_; }
+  bool operator!=(const Cell& other) const { return bits_ != other.bits_; }
+
  private:
-  int num_beepers_ = 0;
-  bool north_wall_ = false;
-  bool east_wall_ = false;
-  bool south_wall_ = false;
-  bool west_wall_ = false;
+  // The low four bits hold one wall per Orientation, the next four whether
+  // each direction is blocked, and the rest hold the number of beepers.
+  static constexpr int kBlockedShift = 4;
+  static constexpr int kBeeperShift = 8;
+  static constexpr uint32_t kFlagMask = (1u << kBeeperShift) - 1;
+
+  uint32_t bits_ = 0;
 };
 
 }  // namespace karel
@@ -0,0 +1,84 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "csv_log.h"
+
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace karel {
+
+CSVLog::~CSVLog() { Close(); }
+
+bool CSVLog::Open(const std::string& filename, bool use_background_thread) {
+  Close();
+  file_.open(filename, std::ios::out | std::ios::trunc);
+  if (!file_.is_open()) return false;
+  use_background_thread_ = use_background_thread;
+  if (use_background_thread_) {
+    closing_ = false;
+    writer_ = std::thread(&CSVLog::WriteLoop, this);
+  }
+  return true;
+}
+
+void CSVLog::Append(const std::string& text) {
+  if (!use_background_thread_) {
+    file_ << text;
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_ += text;
+  }
+  changed_.notify_all();
+}
+
+void CSVLog::Flush() {
+  if (use_background_thread_) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this]() { return pending_.empty() && !writing_; });
+  }
+  file_.flush();
+}
+
+void CSVLog::Close() {
+  if (!file_.is_open()) return;
+  if (use_background_thread_) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closing_ = true;
+    }
+    changed_.notify_all();
+    writer_.join();
+    use_background_thread_ = false;
+  }
+  file_.close();
+}
+
+void CSVLog::WriteLoop() {
+  std::string text;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    changed_.wait(lock, [this]() { return !pending_.empty() || closing_; });
+    if (pending_.empty()) {
+      // Closing with nothing left to write.
+      return;
+    }
+    // Swap buffers so Append can continue while this thread writes.
+    text.swap(pending_);
+    writing_ = true;
+    lock.unlock();
+    file_ << text;
+    text.clear();
+    lock.lock();
+    writing_ = false;
+    changed_.notify_all();
+  }
+}
+
+}  // namespace karel
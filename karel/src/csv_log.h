@@ -0,0 +1,72 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifndef CSV_LOG_H
+#define CSV_LOG_H
+
+namespace karel {
+
+/**
+ * An append-only text file which stays open between writes. Writes are
+ * buffered and, optionally, performed by a background thread so that the
+ * caller never waits on the disk.
+ */
+class CSVLog {
+ public:
+  CSVLog() = default;
+  CSVLog(const CSVLog&) = delete;
+  CSVLog& operator=(const CSVLog&) = delete;
+
+  /**
+   * Writes anything still buffered and closes the file.
+   */
+  ~CSVLog();
+
+  /**
+   * Creates or truncates |filename|. Returns false if it cannot be opened.
+   */
+  bool Open(const std::string& filename, bool use_background_thread);
+
+  /**
+   * Appends |text| to the file. It may not reach the disk until Flush.
+   */
+  void Append(const std::string& text);
+
+  /**
+   * Blocks until everything appended so far is written to the file.
+   */
+  void Flush();
+
+  /**
+   * Flushes and closes the file, stopping the background thread.
+   */
+  void Close();
+
+ private:
+  // Writes pending text on the background thread until closed.
+  void WriteLoop();
+
+  std::ofstream file_;
+  bool use_background_thread_ = false;
+
+  // Text waiting for the background thread, guarded by |mutex_|.
+  std::thread writer_;
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::string pending_;
+  bool writing_ = false;
+  bool closing_ = false;
+};
+
+}  // namespace karel
+
+#endif  // CSV_LOG_H
@@ -16,12 +16,17 @@ namespace karel {
  */
 enum RobotError {
   kNoError = 0,
+  // Move errors are in the same order as Orientation.
   kCannotMoveNorth,
   kCannotMoveEast,
   kCannotMoveSouth,
   kCannotMoveWest,
   kCannotPutBeeper,
   kCannotPickBeeper,
+  // Karel took more steps than allowed by Robot::SetStepBudget.
+  kStepBudgetExceeded,
+  // Karel kept repeating the same state, see Robot::SetLoopDetection.
+  kInfiniteLoop,
 };
 
 }  // namespace karel
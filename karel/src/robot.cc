@@ -8,15 +8,25 @@
 
 #include <math.h>
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
 #include <vector>
 
 #include "../../graphics/image.h"
+#include "binary_world.h"
 #include "cell.h"
+#include "csv_log.h"
 #include "error.h"
 #include "orientation.h"
+#include "stats.h"
+#include "trace.h"
+#include "world_reader.h"
 
 namespace karel {
 
@@ -36,6 +46,12 @@ const int kShortDuration = 30;
 // Number of steps to take in the animation moving karel between cells.
 const int kNumAnimationSteps = 10;
 
+// Slowest allowed animation speed multiplier.
+const double kMinSpeed = 0.1;
+
+// Shortest time between frames in turbo mode: one refresh of a 60 Hz screen.
+const std::chrono::milliseconds kTurboFrameMs(16);
+
 // Pixel constants.
 const int pxPerCell = 50;
 const int markSize = 10;
@@ -51,17 +67,34 @@ const int kErrorFontSize = 20;
 const int margin = 32;
 
 // Color constants.
-const graphics::Color eyeColor(50, 50, 50);
-const graphics::Color karelColor(125, 125, 125);
-const graphics::Color markColor(150, 150, 255);
-const graphics::Color innerBeeperColor(172, 147, 194);
-const graphics::Color limbColor(105, 105, 105);
-const graphics::Color kWhite(255, 255, 255);
-const graphics::Color kWallColor(50, 50, 50);
-const graphics::Color kGridColor(220, 220, 220);
-const graphics::Color kErrorColor(173, 0, 35);
+constexpr graphics::Color eyeColor(50, 50, 50);
+constexpr graphics::Color karelColor(125, 125, 125);
+constexpr graphics::Color markColor(150, 150, 255);
+constexpr graphics::Color innerBeeperColor(172, 147, 194);
+constexpr graphics::Color limbColor(105, 105, 105);
+constexpr graphics::Color kWhite(255, 255, 255);
+constexpr graphics::Color kWallColor(50, 50, 50);
+constexpr graphics::Color kGridColor(220, 220, 220);
+constexpr graphics::Color kErrorColor(173, 0, 35);
+// Marks the pixels of sprites which should not be drawn.
+constexpr graphics::Color kTransparent(255, 0, 255);
 
 const std::string kCSVFilename = "karel.csv";
+const std::string kCSVLogFilename = "karel_log.csv";
+const std::string kCSVLegend =
+    "symbol,kn,ke,ks,kw,o,b,w,\"(x,y)\"\n"
+    "meaning,Karel facing north,Karel facing east, Karel facing south, "
+    "Karel facing west,empty cell,cell with beepers and count,wall "
+    "between cells,cell coordinates\n";
+// Karel's symbol in a CSV cell for each Orientation.
+const char* const kCSVKarelSymbols[] = {"kn ", "ke ", "ks ", "kw "};
+
+// The Robot used by GetInstance on this thread, if not the singleton.
+thread_local Robot* current_instance = nullptr;
+
+// Change in world coordinates for one step in each Orientation.
+const int kDeltaX[] = {0, 1, 0, -1};
+const int kDeltaY[] = {-1, 0, 1, 0};
 
 // Helper methods
 void ParseWorldFileError(std::string error_text, int line_number) {
@@ -116,6 +149,12 @@ std::string GetErrorMessage(RobotError error) {
     case kCannotPutBeeper:
       message += " Cannot put beeper\n(No beepers in bag)";
       break;
+    case kStepBudgetExceeded:
+      message += "    Too many steps\n(Step budget used up)";
+      break;
+    case kInfiniteLoop:
+      message += "   Stuck in a loop\n(No progress made)";
+      break;
   }
   return message;
 }
@@ -124,12 +163,20 @@ std::string GetErrorMessage(RobotError error) {
 
 Robot::Robot() {}
 
-// Singleton. Static.
+// Static.
 karel::Robot& Robot::PrivateGetInstance() {
+  if (current_instance) {
+    return *current_instance;
+  }
   static Robot instance;
   return instance;
 }
 
+// Static.
+void Robot::SetCurrentInstance(karel::Robot* robot) {
+  current_instance = robot;
+}
+
 // static.
 karel::Robot& Robot::GetInstance(bool enable_graphics, bool force_initialize) {
   karel::Robot& instance = PrivateGetInstance();
@@ -147,190 +194,220 @@ karel::Robot& Robot::InitializeInstance(std::string filename,
   return instance;
 }
 
-void Robot::Initialize(std::string filename, bool enable_graphics,
-                       bool force_initialize) {
-  // Ensure only intitialized once unless |force_initialize| is true.
-  if (initialized_ && !force_initialize) return;
+void Robot::LoadWorld(std::string filename, bool enable_graphics) {
+  Initialize(filename, enable_graphics, /* force initialize */ true);
+}
+
+void Robot::ResetState(bool enable_graphics, bool force_initialize) {
   finished_ = false;
   if (force_initialize) {
     prompt_between_actions_ = false;
     enable_csv_output_ = false;
+    turbo_mode_ = false;
+    csv_log_.reset();
+    stats_filename_.clear();
+    count_visits_ = false;
   }
+  csv_log_started_ = false;
+  csv_changes_since_snapshot_ = 0;
   // Reset default speed and beeper count.
   speed_ = 1;
+  num_actions_ = 0;
+  num_steps_ = 0;
+  queries_since_action_ = 0;
+  std::fill(state_visits_.begin(), state_visits_.end(), StateVisits());
   // Nearly infinite beepers.
   beeper_count_ = std::numeric_limits<int>::max();
-  world_.clear();
   enable_graphics_ = enable_graphics;
+}
+
+void Robot::Initialize(std::string filename, bool enable_graphics,
+                       bool force_initialize) {
+  // Ensure only intitialized once unless |force_initialize| is true.
+  if (initialized_ && !force_initialize) return;
+  ResetState(enable_graphics, force_initialize);
 
   if (!filename.size()) {
     // No file. Default 10x10 blank world with no walls and no beepers.
     x_dimen_ = kDefaultDimen;
     y_dimen_ = kDefaultDimen;
-    for (int i = 0; i < x_dimen_; i++) {
-      world_.push_back(std::vector<Cell>());
-      for (int j = 0; j < y_dimen_; j++) {
-        world_[i].push_back(Cell());
-      }
-    }
+    world_.Reset(x_dimen_, y_dimen_, world_storage_);
     position_ = {0, kDefaultDimen - 1, Orientation::kEast};
   } else {
-    std::fstream world_file;
-    try {
-      world_file.open(filename);
-    } catch (std::ifstream::failure e) {
+    MappedFile world_file;
+    if (!world_file.Open(filename)) {
       ParseWorldFileError("Error opening file " + filename, -1);
     }
-    if (!world_file.is_open()) {
-      ParseWorldFileError("Error opening file " + filename, -1);
-    }
-    std::string line;
-    int line_number = 1;
-
-    const std::string dimension_prefix = "Dimension:";
-    const std::string beeper_prefix = "Beeper:";
-    const std::string wall_prefix = "Wall:";
-    const std::string bag_prefix = "BeeperBag:";
-    const std::string karel_prefix = "Karel:";
-    const std::string speed_prefix = "Speed:";
-
-    std::string line_prefix;
-    char open_paren, comma, closed_paren;
-    if (!(world_file >> line_prefix >> open_paren >> x_dimen_ >> comma >>
-          y_dimen_ >> closed_paren)) {
-      ParseWorldFileError(
-          "Could not parse world dimensions from the first line", line_number);
-    }
-    if (line_prefix != dimension_prefix) {
-      ParseWorldFileError("Could not find \"Dimension:\" in first line",
-                          line_number);
-    }
-    CheckParsePosition(open_paren, comma, closed_paren, line_number);
-    if (x_dimen_ < 1 || y_dimen_ < 1) {
-      ParseWorldFileError(
-          "Cannot load a world less than 1 cell wide or less than 1 cell "
-          "tall",
-          line_number);
-    }
-    for (int i = 0; i < x_dimen_; i++) {
-      world_.push_back(std::vector<Cell>());
-      for (int j = 0; j < y_dimen_; j++) {
-        world_[i].push_back(Cell());
-      }
+    if (IsBinaryWorld(world_file.GetData(), world_file.GetSize())) {
+      LoadBinaryWorld(world_file.GetData(), world_file.GetSize());
+    } else {
+      WorldReader reader(world_file.GetData(), world_file.GetSize());
+      ParseWorld(&reader);
     }
+  }
+  FinishLoading();
+}
 
-    // Read the rest of the file to get beepers and walls.
-    while (world_file >> line_prefix) {
-      line_number++;
-      if (line_prefix == wall_prefix) {
-        PositionAndOrientation wall =
-            ParsePositionAndOrientation(world_file, line_number);
-        world_[wall.x][wall.y].AddWall(wall.orientation);
-      } else if (line_prefix == beeper_prefix) {
-        PositionAndOrientation beeper = ParsePosition(world_file, line_number);
-        int count;
-        if (!(world_file >> count)) {
-          ParseWorldFileError("Error reading Beeper count", line_number);
-        }
-        world_[beeper.x][beeper.y].SetNumBeepers(count);
-      } else if (line_prefix == bag_prefix) {
-        std::string beepers;
-        if (!(world_file >> beepers)) {
-          ParseWorldFileError("Error reading quantity for BeeperBag",
-                              line_number);
-        }
-        if (beepers == "INFINITY" || beepers == "INFINITE") {
-          beeper_count_ = std::numeric_limits<int>::max();
-        } else {
-          try {
-            beeper_count_ = stoi(beepers);
-          } catch (std::invalid_argument& e) {
-            ParseWorldFileError("Unknown BeeperBag quanity, " + beepers,
-                                line_number);
-          }
-        }
-      } else if (line_prefix == karel_prefix) {
-        position_ = ParsePositionAndOrientation(world_file, line_number);
-      } else if (line_prefix == speed_prefix) {
-        if (!(world_file >> speed_)) {
-          ParseWorldFileError("Error reading Speed", line_number);
-        }
-        if (speed_ < 0) {
-          ParseWorldFileError("Speed must be greater than 0", line_number);
-        } else if (speed_ < 0.1) {
-          // Minimum speed.
-          speed_ = 0.1;
-        }
-      } else {
-        ParseWorldFileError("Unexpected token in file: " + line_prefix,
+void Robot::LoadWorldFromString(const std::string& contents,
+                                bool enable_graphics) {
+  ResetState(enable_graphics, /* force initialize */ true);
+  WorldReader reader(contents.data(), contents.size());
+  ParseWorld(&reader);
+  FinishLoading();
+}
+
+void Robot::ParseWorld(WorldReader* reader) {
+  int line_number = 1;
+
+  const std::string_view dimension_prefix = "Dimension:";
+  const std::string_view beeper_prefix = "Beeper:";
+  const std::string_view wall_prefix = "Wall:";
+  const std::string_view bag_prefix = "BeeperBag:";
+  const std::string_view karel_prefix = "Karel:";
+  const std::string_view speed_prefix = "Speed:";
+
+  std::string_view line_prefix;
+  char open_paren, comma, closed_paren;
+  if (!(reader->ReadToken(&line_prefix) && reader->ReadChar(&open_paren) &&
+        reader->ReadInt(&x_dimen_) && reader->ReadChar(&comma) &&
+        reader->ReadInt(&y_dimen_) && reader->ReadChar(&closed_paren))) {
+    ParseWorldFileError("Could not parse world dimensions from the first line",
+                        line_number);
+  }
+  if (line_prefix != dimension_prefix) {
+    ParseWorldFileError("Could not find \"Dimension:\" in first line",
+                        line_number);
+  }
+  CheckParsePosition(open_paren, comma, closed_paren, line_number);
+  if (x_dimen_ < 1 || y_dimen_ < 1) {
+    ParseWorldFileError(
+        "Cannot load a world less than 1 cell wide or less than 1 cell "
+        "tall",
+        line_number);
+  }
+  world_.Reset(x_dimen_, y_dimen_, world_storage_);
+
+  // Read the rest of the file to get beepers and walls.
+  while (reader->ReadToken(&line_prefix)) {
+    line_number++;
+    if (line_prefix == wall_prefix) {
+      PositionAndOrientation wall =
+          ParsePositionAndOrientation(reader, line_number);
+      world_.AddWall(wall.x, wall.y, wall.orientation);
+    } else if (line_prefix == beeper_prefix) {
+      PositionAndOrientation beeper = ParsePosition(reader, line_number);
+      int count;
+      if (!reader->ReadInt(&count)) {
+        ParseWorldFileError("Error reading Beeper count", line_number);
+      }
+      if (count > Cell::kMaxBeepers) {
+        ParseWorldFileError("A cell cannot hold more than " +
+                                std::to_string(Cell::kMaxBeepers) +
+                                " beepers",
                             line_number);
-        break;
       }
+      world_.SetNumBeepers(beeper.x, beeper.y, count);
+    } else if (line_prefix == bag_prefix) {
+      std::string_view beepers;
+      if (!reader->ReadToken(&beepers)) {
+        ParseWorldFileError("Error reading quantity for BeeperBag",
+                            line_number);
+      }
+      if (beepers == "INFINITY" || beepers == "INFINITE") {
+        beeper_count_ = std::numeric_limits<int>::max();
+      } else if (!WorldReader::ParseInt(beepers, &beeper_count_)) {
+        ParseWorldFileError(
+            "Unknown BeeperBag quanity, " + std::string(beepers),
+            line_number);
+      }
+    } else if (line_prefix == karel_prefix) {
+      position_ = ParsePositionAndOrientation(reader, line_number);
+    } else if (line_prefix == speed_prefix) {
+      if (!reader->ReadDouble(&speed_)) {
+        ParseWorldFileError("Error reading Speed", line_number);
+      }
+      if (speed_ < 0) {
+        ParseWorldFileError("Speed must be greater than 0", line_number);
+      } else if (speed_ < kMinSpeed) {
+        speed_ = kMinSpeed;
+      }
+    } else {
+      ParseWorldFileError(
+          "Unexpected token in file: " + std::string(line_prefix),
+          line_number);
     }
-    world_file.close();
   }
-  int min_width = 5 * pxPerCell + margin;
-  image_.Initialize(std::max(x_dimen_ * pxPerCell + margin, min_width),
-                    y_dimen_ * pxPerCell + margin);
+}
 
+void Robot::LoadBinaryWorld(const char* data, size_t size) {
+  BinaryWorldHeader header;
+  std::string error;
+  if (!DecodeBinaryWorld(data, size, world_storage_, &world_, &header,
+                         &error)) {
+    ParseWorldFileError(error, -1);
+  }
+  x_dimen_ = world_.GetWidth();
+  y_dimen_ = world_.GetHeight();
+  position_ = header.karel;
+  beeper_count_ = header.beepers_in_bag;
+  speed_ = std::max(header.speed, kMinSpeed);
+}
+
+void Robot::SaveWorldBinary(std::string filename) const {
+  BinaryWorldHeader header;
+  header.karel = position_;
+  header.beepers_in_bag = beeper_count_;
+  header.speed = speed_;
+  std::string data = EncodeBinaryWorld(world_, header);
+  std::ofstream file(filename, std::ios::binary);
+  if (!(file << data)) {
+    throw "Error writing file " + filename;
+  }
+}
+
+void Robot::FinishLoading() {
   initialized_ = true;
   error_ = RobotError::kNoError;
 
-  DrawWorld();
-  DrawRobot();
+  stats_.Reset(x_dimen_, y_dimen_, world_.GetStorage());
+  if (count_visits_) stats_.EnableVisits();
+  stats_.Visit(position_.x, position_.y);
+
+  background_stale_ = true;
+  if (enable_graphics_) {
+    RenderImage();
+  } else {
+    // Headless: nothing is drawn until the image is requested.
+    image_stale_ = true;
+  }
   Show(/* long duration */ true);
 }
 
 void Robot::Move() {
+  CountStep(/* is action */ true);
   if (finished_) return;
   PromptBeforeActionIfNeeded();
-  switch (position_.orientation) {
-    case Orientation::kNorth:
-      if (position_.y == 0) {
-        Error(RobotError::kCannotMoveNorth);
-      } else if (world_[position_.x][position_.y].HasNorthWall() ||
-                 world_[position_.x][position_.y - 1].HasSouthWall()) {
-        Error(RobotError::kCannotMoveNorth);
-      } else {
-        AnimateMove(position_.x, position_.y - 1);
-      }
-      break;
-    case Orientation::kEast:
-      if (position_.x == x_dimen_ - 1) {
-        Error(RobotError::kCannotMoveEast);
-      } else if (world_[position_.x][position_.y].HasEastWall() ||
-                 world_[position_.x + 1][position_.y].HasWestWall()) {
-        Error(RobotError::kCannotMoveEast);
-      } else {
-        AnimateMove(position_.x + 1, position_.y);
-      }
-      break;
-    case Orientation::kSouth:
-      if (position_.y == y_dimen_ - 1) {
-        Error(RobotError::kCannotMoveSouth);
-      } else if (world_[position_.x][position_.y].HasSouthWall() ||
-                 world_[position_.x][position_.y + 1].HasNorthWall()) {
-        Error(RobotError::kCannotMoveSouth);
-      } else {
-        AnimateMove(position_.x, position_.y + 1);
-      }
-      break;
-    case Orientation::kWest:
-      if (position_.x == 0) {
-        Error(RobotError::kCannotMoveWest);
-      } else if (world_[position_.x][position_.y].HasWestWall() ||
-                 world_[position_.x - 1][position_.y].HasEastWall()) {
-        Error(RobotError::kCannotMoveWest);
-      } else {
-        AnimateMove(position_.x - 1, position_.y);
-      }
-      break;
+  num_actions_++;
+  Orientation orientation = position_.orientation;
+  if (!DirectionIsClear(orientation)) {
+    Record(TraceOp::kMove, false);
+    // The kCannotMove errors are in the same order as the orientations.
+    Error(static_cast<RobotError>(RobotError::kCannotMoveNorth + orientation));
+    return;
   }
+  Record(TraceOp::kMove, true);
+  AnimateMove(position_.x + kDeltaX[orientation],
+              position_.y + kDeltaY[orientation]);
+  stats_.Visit(position_.x, position_.y);
+  CheckForLoop();
 }
 
 void Robot::TurnLeft() {
+  CountStep(/* is action */ true);
   if (finished_) return;
   PromptBeforeActionIfNeeded();
+  num_actions_++;
+  Record(TraceOp::kTurnLeft, true);
   switch (position_.orientation) {
     case Orientation::kNorth:
       position_.orientation = Orientation::kWest;
@@ -345,84 +422,133 @@ void Robot::TurnLeft() {
       position_.orientation = Orientation::kSouth;
       break;
   }
-  DrawWorld();
-  DrawRobot();
+  MarkCellDirty(position_.x, position_.y);
+  Redraw();
   Show(/* long duration */ true);
+  CheckForLoop();
 }
 
 void Robot::PutBeeper() {
+  CountStep(/* is action */ true);
   if (finished_) return;
   PromptBeforeActionIfNeeded();
-  if (!HasBeepersInBag()) {
+  num_actions_++;
+  // Karel cannot put a beeper if the bag is empty or the cell is full.
+  const int beepers = world_.GetCell(position_.x, position_.y).GetNumBeepers();
+  if (beeper_count_ <= 0 || beepers >= Cell::kMaxBeepers) {
+    Record(TraceOp::kPutBeeper, false);
     Error(RobotError::kCannotPutBeeper);
     return;
   }
+  Record(TraceOp::kPutBeeper, true);
   if (beeper_count_ != std::numeric_limits<int>::max()) {
     beeper_count_--;
   }
-  Cell& cell = world_[position_.x][position_.y];
-  cell.SetNumBeepers(cell.GetNumBeepers() + 1);
-  DrawWorld();
-  DrawRobot();
+  world_.SetNumBeepers(position_.x, position_.y, beepers + 1);
+  MarkCellDirty(position_.x, position_.y);
+  Redraw();
   Show(/* long duration */ true);
+  CheckForLoop();
 }
 
 void Robot::PickBeeper() {
+  CountStep(/* is action */ true);
   if (finished_) return;
   PromptBeforeActionIfNeeded();
-  if (!BeepersPresent()) {
+  num_actions_++;
+  if (world_.GetCell(position_.x, position_.y).GetNumBeepers() == 0) {
+    Record(TraceOp::kPickBeeper, false);
     Error(RobotError::kCannotPickBeeper);
     return;
   }
-  Cell& cell = world_[position_.x][position_.y];
-  cell.SetNumBeepers(cell.GetNumBeepers() - 1);
+  Record(TraceOp::kPickBeeper, true);
+  world_.SetNumBeepers(
+      position_.x, position_.y,
+      world_.GetCell(position_.x, position_.y).GetNumBeepers() - 1);
   if (beeper_count_ != std::numeric_limits<int>::max()) {
     beeper_count_++;
   }
-  DrawWorld();
-  DrawRobot();
+  MarkCellDirty(position_.x, position_.y);
+  Redraw();
   Show(/* long duration */ true);
+  CheckForLoop();
 }
 
-bool Robot::HasBeepersInBag() const { return beeper_count_ > 0; }
+bool Robot::HasBeepersInBag() {
+  CountStep(/* is action */ false);
+  bool result = beeper_count_ > 0;
+  Record(TraceOp::kHasBeepersInBag, result);
+  return result;
+}
 
-bool Robot::BeepersPresent() const {
-  return world_[position_.x][position_.y].GetNumBeepers() > 0;
+bool Robot::BeepersPresent() {
+  CountStep(/* is action */ false);
+  bool result = world_.GetCell(position_.x, position_.y).GetNumBeepers() > 0;
+  Record(TraceOp::kBeepersPresent, result);
+  return result;
 }
 
-bool Robot::FrontIsClear() const {
-  return DirectionIsClear(position_.orientation);
+bool Robot::FrontIsClear() {
+  CountStep(/* is action */ false);
+  bool result = DirectionIsClear(position_.orientation);
+  Record(TraceOp::kFrontIsClear, result);
+  return result;
 }
 
-bool Robot::LeftIsClear() const {
-  return DirectionIsClear(static_cast<Orientation>(
+bool Robot::LeftIsClear() {
+  CountStep(/* is action */ false);
+  bool result = DirectionIsClear(static_cast<Orientation>(
       (static_cast<int>(position_.orientation) - 1 + 4) % 4));
+  Record(TraceOp::kLeftIsClear, result);
+  return result;
 }
 
-bool Robot::RightIsClear() const {
-  return DirectionIsClear(static_cast<Orientation>(
+bool Robot::RightIsClear() {
+  CountStep(/* is action */ false);
+  bool result = DirectionIsClear(static_cast<Orientation>(
       (static_cast<int>(position_.orientation) + 1) % 4));
+  Record(TraceOp::kRightIsClear, result);
+  return result;
 }
 
-bool Robot::FacingNorth() const {
-  return position_.orientation == Orientation::kNorth;
+bool Robot::FacingNorth() {
+  CountStep(/* is action */ false);
+  bool result = position_.orientation == Orientation::kNorth;
+  Record(TraceOp::kFacingNorth, result);
+  return result;
 }
 
-bool Robot::FacingEast() const {
-  return position_.orientation == Orientation::kEast;
+bool Robot::FacingEast() {
+  CountStep(/* is action */ false);
+  bool result = position_.orientation == Orientation::kEast;
+  Record(TraceOp::kFacingEast, result);
+  return result;
 }
 
-bool Robot::FacingSouth() const {
-  return position_.orientation == Orientation::kSouth;
+bool Robot::FacingSouth() {
+  CountStep(/* is action */ false);
+  bool result = position_.orientation == Orientation::kSouth;
+  Record(TraceOp::kFacingSouth, result);
+  return result;
 }
 
-bool Robot::FacingWest() const {
-  return position_.orientation == Orientation::kWest;
+bool Robot::FacingWest() {
+  CountStep(/* is action */ false);
+  bool result = position_.orientation == Orientation::kWest;
+  Record(TraceOp::kFacingWest, result);
+  return result;
 }
 
 void Robot::Finish() {
   if (finished_) return;
   finished_ = true;
+  if (csv_log_) {
+    AppendCSVLog(/* snapshot */ true);
+    csv_log_->Flush();
+  }
+  if (!stats_filename_.empty()) {
+    WriteStats();
+  }
   if (enable_csv_output_) {
     WriteWorldCSV();
     std::cout << "Finished. ctrl+c to exit." << std::endl << std::flush;
@@ -435,8 +561,139 @@ void Robot::Finish() {
   }
 }
 
+RobotSnapshot Robot::TakeSnapshot() const {
+  RobotSnapshot snapshot;
+  snapshot.world = world_;
+  snapshot.position = position_;
+  snapshot.beepers_in_bag = beeper_count_;
+  snapshot.error = error_;
+  snapshot.finished = finished_;
+  snapshot.num_actions = num_actions_;
+  return snapshot;
+}
+
+void Robot::RestoreSnapshot(const RobotSnapshot& snapshot) {
+  world_ = snapshot.world;
+  x_dimen_ = world_.GetWidth();
+  y_dimen_ = world_.GetHeight();
+  if (stats_.GetWidth() != x_dimen_ || stats_.GetHeight() != y_dimen_) {
+    stats_.Reset(x_dimen_, y_dimen_, world_.GetStorage());
+    if (count_visits_) stats_.EnableVisits();
+  }
+  position_ = snapshot.position;
+  beeper_count_ = snapshot.beepers_in_bag;
+  error_ = snapshot.error;
+  finished_ = snapshot.finished;
+  num_actions_ = snapshot.num_actions;
+  queries_since_action_ = 0;
+  // The snapshot may have different walls or a different size.
+  background_stale_ = true;
+  dirty_cells_.clear();
+  if (enable_graphics_) {
+    RenderImage();
+    image_.Flush();
+  } else {
+    image_stale_ = true;
+  }
+}
+
+void Robot::SetStepBudget(int64_t max_steps) { step_budget_ = max_steps; }
+
+void Robot::SetLoopDetection(int max_repeats) {
+  max_repeats_ = max_repeats;
+  if (max_repeats > 0) {
+    state_visits_.assign(size_t{1} << kStateTableBits, StateVisits());
+  } else {
+    std::vector<StateVisits>().swap(state_visits_);
+  }
+}
+
+void Robot::StartRecording(Trace* trace) { trace_ = trace; }
+
+void Robot::StopRecording() { trace_ = nullptr; }
+
+bool Robot::ReplayTrace(const Trace& trace, size_t num_records) {
+  bool matches = true;
+  for (size_t i = 0; i < num_records && i < trace.GetSize(); i++) {
+    bool result = false;
+    int64_t actions_before = num_actions_;
+    switch (trace.GetOp(i)) {
+      case TraceOp::kMove:
+        Move();
+        break;
+      case TraceOp::kTurnLeft:
+        TurnLeft();
+        break;
+      case TraceOp::kPutBeeper:
+        PutBeeper();
+        break;
+      case TraceOp::kPickBeeper:
+        PickBeeper();
+        break;
+      case TraceOp::kHasBeepersInBag:
+        result = HasBeepersInBag();
+        break;
+      case TraceOp::kBeepersPresent:
+        result = BeepersPresent();
+        break;
+      case TraceOp::kFrontIsClear:
+        result = FrontIsClear();
+        break;
+      case TraceOp::kLeftIsClear:
+        result = LeftIsClear();
+        break;
+      case TraceOp::kRightIsClear:
+        result = RightIsClear();
+        break;
+      case TraceOp::kFacingNorth:
+        result = FacingNorth();
+        break;
+      case TraceOp::kFacingEast:
+        result = FacingEast();
+        break;
+      case TraceOp::kFacingSouth:
+        result = FacingSouth();
+        break;
+      case TraceOp::kFacingWest:
+        result = FacingWest();
+        break;
+    }
+    if (num_actions_ != actions_before) {
+      // An action succeeded if it was taken without an error.
+      result = error_ == RobotError::kNoError;
+    }
+    matches = matches && result == trace.GetResult(i);
+  }
+  return matches;
+}
+
+void Robot::EnableTurboMode() { turbo_mode_ = true; }
+
+void Robot::SetSpeed(double speed) {
+  // Same minimum speed as the Speed: line in world files.
+  speed_ = std::max(speed, kMinSpeed);
+}
+
+double Robot::GetSpeed() const { return speed_; }
+
 void Robot::EnablePromptBeforeAction() { prompt_between_actions_ = true; }
 
+void Robot::EnableStatsOutput(std::string filename) {
+  stats_filename_ = filename;
+  EnableVisitCounts();
+}
+
+void Robot::EnableVisitCounts() {
+  count_visits_ = true;
+  if (!initialized_ || stats_.CountsVisits()) return;
+  stats_.EnableVisits();
+  stats_.Visit(position_.x, position_.y);
+}
+
+void Robot::SetWorldStorage(WorldStorage storage) {
+  world_storage_ = storage;
+}
+
 void Robot::EnableCSVOutput() {
   enable_csv_output_ = true;
   prompt_between_actions_ = true;
@@ -455,8 +712,8 @@ int Robot::GetYPosition() const { return y_dimen_ - position_.y; }
 
 int Robot::GetNumBeepersInBag() const { return beeper_count_; }
 
-const Cell& Robot::GetCell(int x, int y) const {
-  return world_[x - 1][y_dimen_ - y];
+Cell Robot::GetCell(int x, int y) const {
+  return world_.GetCell(x - 1, y_dimen_ - y);
 }
 
 int Robot::GetWorldWidth() const { return x_dimen_; }
@@ -465,7 +722,51 @@ int Robot::GetWorldHeight() const { return y_dimen_; }
 
 RobotError Robot::GetError() const { return error_; }
 
-void Robot::SaveWorldBmp(std::string filename) const {
+int64_t Robot::GetNumActions() const { return num_actions_; }
+
+int64_t Robot::GetNumSteps() const { return num_steps_; }
+
+const RobotStats& Robot::GetStats() const { return stats_; }
+
+uint64_t Robot::GetStateHash() const {
+  uint64_t index = static_cast<uint64_t>(position_.y) * x_dimen_ + position_.x;
+  // Distinct salts keep Karel's keys apart from each other and from the
+  // world's keys.
+  return world_.GetHash() ^
+         HashMix((index << 2 | position_.orientation) ^ 0x4b4152454cULL) ^
+         HashMix(static_cast<uint64_t>(beeper_count_) ^ (0x424147ULL << 40));
+}
+
+bool Robot::WorldMatches(const RobotSnapshot& expected,
+                         size_t max_differences,
+                         std::vector<CellDifference>* differences) const {
+  size_t first_difference = differences ? differences->size() : 0;
+  if (world_.Matches(expected.world, max_differences, differences)) {
+    return true;
+  }
+  if (differences) {
+    // Convert to grid coordinates.
+    for (size_t i = first_difference; i < differences->size(); i++) {
+      CellDifference& difference = (*differences)[i];
+      difference.x += 1;
+      difference.y = y_dimen_ - difference.y;
+    }
+  }
+  return false;
+}
+
+bool Robot::WorldMatchesFile(std::string filename, size_t max_differences,
+                             std::vector<CellDifference>* differences) const {
+  Robot expected;
+  expected.SetWorldStorage(world_storage_);
+  expected.LoadWorld(filename, /* enable graphics */ false);
+  return WorldMatches(expected.TakeSnapshot(), max_differences, differences);
+}
+
+void Robot::SaveWorldBmp(std::string filename) {
+  if (image_stale_) {
+    RenderImage();
+  }
   if (!image_.SaveImageBmp(filename)) {
     std::cout << "Failed to save image to " << filename << std::endl
               << std::flush;
@@ -477,10 +778,46 @@ void Robot::Show(bool long_duration) {
   if (long_duration && enable_csv_output_) {
     WriteWorldCSV();
   }
-  if (enable_graphics_) {
-    image_.ShowForMs((long_duration ? kLongDuration : kShortDuration) / speed_,
-                     "Karel's World");
+  if (long_duration && csv_log_) {
+    AppendCSVLog(/* snapshot */ !csv_log_started_);
+    csv_log_started_ = true;
   }
+  if (!enable_graphics_) return;
+  if (turbo_mode_) {
+    // Only present a frame once per screen refresh, without waiting. Frames
+    // in between are skipped; the next one shows all the changes.
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_frame_time_ >= kTurboFrameMs) {
+      last_frame_time_ = now;
+      stats_.CountFrame();
+      image_.ShowForMs(0, "Karel's World");
+    }
+    return;
+  }
+  PresentFrame((long_duration ? kLongDuration : kShortDuration) / speed_);
+}
+
+void Robot::PresentFrame(double milliseconds) {
+  auto now = std::chrono::steady_clock::now();
+  auto frame_duration = std::chrono::duration_cast<
+      std::chrono::steady_clock::duration>(
+      std::chrono::duration<double, std::milli>(milliseconds));
+  if (frame_deadline_ < now - frame_duration) {
+    // Nothing was shown for a while, for example while waiting for input, so
+    // start a new schedule.
+    frame_deadline_ = now;
+  }
+  // The time spent drawing since the last deadline counts toward this frame,
+  // so frames stay on schedule however long they take to draw.
+  frame_deadline_ += frame_duration;
+  int wait_ms = 0;
+  if (frame_deadline_ > now) {
+    wait_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  frame_deadline_ - now)
+                  .count();
+  }
+  stats_.CountFrame();
+  image_.ShowForMs(wait_ms, "Karel's World");
 }
 
 void Robot::WriteWorldCSV() {
@@ -494,57 +831,110 @@ void Robot::WriteWorldCSV() {
               << std::flush;
     return;
   }
+  std::string text;
+  AppendWorldCSV(&text);
+  text += kCSVLegend;
+  csv << text;
+  csv.close();
+  std::cout << "World state written to " << kCSVFilename << std::endl
+            << std::flush;
+}
+
+void Robot::WriteStats() {
+  std::ofstream file(stats_filename_);
+  if (!(file << stats_.ToJSON())) {
+    std::cout << "Error: Could not write Karel's stats to " << stats_filename_
+              << std::endl
+              << std::flush;
+  }
+}
+
+void Robot::AppendWorldCSV(std::string* csv) const {
   for (int y = 0; y < y_dimen_; y++) {
     for (int x = 0; x < x_dimen_; x++) {
       // print contents walls.
-      Cell& cell = world_[x][y];
-      csv << "\"";
-      if (x == position_.x && y == position_.y) {
-        if (position_.orientation == Orientation::kNorth) {
-          csv << "kn ";
-        } else if (position_.orientation == Orientation::kEast) {
-          csv << "ke ";
-        } else if (position_.orientation == Orientation::kSouth) {
-          csv << "ks ";
-        } else {
-          csv << "kw ";
-        }
-      }
-      if (cell.GetNumBeepers() > 0) {
-        csv << "b" << cell.GetNumBeepers() << " ";
-      } else {
-        csv << "o ";
-      }
-      csv << "(" << x + 1 << "," << y_dimen_ - y << ")\",";
+      AppendCellCSV(x, y, csv);
+      *csv += ',';
       if (x < x_dimen_ - 1) {
-        if (cell.HasEastWall() || world_[x + 1][y].HasWestWall()) {
-          csv << "w,";
-        } else {
-          csv << ",";
-        }
+        *csv += world_.GetCell(x, y).IsBlocked(Orientation::kEast) ? "w," : ",";
       }
     }
-    csv << std::endl;
+    *csv += '\n';
     if (y < y_dimen_ - 1) {
       for (int x = 0; x < x_dimen_; x++) {
         // print bottom walls and next top walls
-        if (world_[x][y].HasSouthWall() || world_[x][y + 1].HasNorthWall()) {
-          csv << "w,,";
+        if (world_.GetCell(x, y).IsBlocked(Orientation::kSouth)) {
+          *csv += "w,,";
         } else {
-          csv << ",,";
+          *csv += ",,";
         }
       }
     }
-    csv << std::endl;
+    *csv += '\n';
   }
-  csv << GetErrorMessage(error_) << std::endl;
-  csv << "symbol,kn,ke,ks,kw,o,b,w,\"(x,y)\"\n";
-  csv << "meaning,Karel facing north,Karel facing east, Karel facing south, "
-         "Karel facing west,empty cell,cell with beepers and count,wall "
-         "between cells,cell coordinates\n";
-  csv.close();
-  std::cout << "World state written to " << kCSVFilename << std::endl
-            << std::flush;
+  *csv += GetErrorMessage(error_);
+  *csv += '\n';
+}
+
+void Robot::AppendCellCSV(int x, int y, std::string* csv) const {
+  *csv += '"';
+  if (x == position_.x && y == position_.y) {
+    *csv += kCSVKarelSymbols[position_.orientation];
+  }
+  int beepers = world_.GetCell(x, y).GetNumBeepers();
+  if (beepers > 0) {
+    *csv += 'b';
+    *csv += std::to_string(beepers);
+    *csv += ' ';
+  } else {
+    *csv += "o ";
+  }
+  *csv += '(';
+  *csv += std::to_string(x + 1);
+  *csv += ',';
+  *csv += std::to_string(y_dimen_ - y);
+  *csv += ")\"";
+}
+
+void Robot::EnableIncrementalCSVOutput(int snapshot_interval,
+                                       bool use_background_thread) {
+  csv_log_ = std::make_unique<CSVLog>();
+  if (!csv_log_->Open(kCSVLogFilename, use_background_thread)) {
+    std::cout << "Error: Could not open " << kCSVLogFilename
+              << " to write Karel's world." << std::endl
+              << std::flush;
+    csv_log_.reset();
+    return;
+  }
+  csv_snapshot_interval_ = snapshot_interval;
+  csv_log_->Append(kCSVLegend);
+  if (initialized_) {
+    AppendCSVLog(/* snapshot */ true);
+    csv_log_started_ = true;
+  }
+}
+
+void Robot::AppendCSVLog(bool snapshot) {
+  std::string text;
+  if (snapshot || (csv_snapshot_interval_ > 0 &&
+                   ++csv_changes_since_snapshot_ >= csv_snapshot_interval_)) {
+    text += "snapshot," + std::to_string(num_actions_) + '\n';
+    AppendWorldCSV(&text);
+    csv_changes_since_snapshot_ = 0;
+  } else {
+    // Walls never change and beepers only change under Karel, so only the
+    // cells Karel left and is now in can differ.
+    text += "step," + std::to_string(num_actions_) + '\n';
+    if (csv_last_position_.x != position_.x ||
+        csv_last_position_.y != position_.y) {
+      AppendCellCSV(csv_last_position_.x, csv_last_position_.y, &text);
+      text += '\n';
+    }
+    AppendCellCSV(position_.x, position_.y, &text);
+    text += '\n';
+  }
+  csv_last_position_ = position_;
+  csv_log_->Append(text);
 }
 
 void Robot::Error(RobotError error) {
@@ -552,8 +942,17 @@ void Robot::Error(RobotError error) {
   if (error_ == RobotError::kNoError) {
     return;
   }
-  std::string message = GetErrorMessage(error);
-  std::cout << message << std::endl << std::flush;
+  std::cout << GetErrorMessage(error) << std::endl << std::flush;
+  if (enable_graphics_) {
+    DrawError();
+  } else {
+    image_stale_ = true;
+  }
+  Finish();
+}
+
+void Robot::DrawError() {
+  std::string message = GetErrorMessage(error_);
   int approx_width = 25 * kErrorFontSize / 4;
   int text_x = std::max(2, image_.GetWidth() / 2 - approx_width);
   int text_y = image_.GetHeight() / 2 - kErrorFontSize / 2;
@@ -562,75 +961,97 @@ void Robot::Error(RobotError error) {
   image_.DrawText(text_x - 2, text_y + 2, message, kErrorFontSize, kWhite);
   image_.DrawText(text_x + 2, text_y + 2, message, kErrorFontSize, kWhite);
   image_.DrawText(text_x, text_y, message, kErrorFontSize, kErrorColor);
-  Finish();
+}
+
+void Robot::CountStep(bool is_action) {
+  num_steps_++;
+  if (step_budget_ > 0 && num_steps_ > step_budget_) {
+    Abort(RobotError::kStepBudgetExceeded);
+  }
+  if (max_repeats_ > 0 && !is_action &&
+      ++queries_since_action_ > kMaxQueriesWithoutAction) {
+    // Nothing changes between sensor queries, so many in a row mean the
+    // program is spinning without acting.
+    Abort(RobotError::kInfiniteLoop);
+  }
+}
+
+void Robot::CheckForLoop() {
+  queries_since_action_ = 0;
+  if (max_repeats_ <= 0) return;
+  uint64_t hash = GetStateHash();
+  // State hashes are well mixed, so their low bits pick the entry.
+  StateVisits& entry =
+      state_visits_[hash & ((size_t{1} << kStateTableBits) - 1)];
+  if (entry.hash != hash) entry = {hash, 0};
+  if (++entry.visits > max_repeats_) {
+    Abort(RobotError::kInfiniteLoop);
+  }
+}
+
+void Robot::Abort(RobotError error) {
+  if (!finished_) {
+    Error(error);
+  }
+  throw error;
 }
 
 bool Robot::DirectionIsClear(Orientation orientation) const {
-  switch (orientation) {
-    case Orientation::kNorth:
-      if (position_.y == 0) {
-        return false;
-      } else if (world_[position_.x][position_.y].HasNorthWall() ||
-                 world_[position_.x][position_.y - 1].HasSouthWall()) {
-        return false;
-      } else {
-        return true;
-      }
-      break;
-    case Orientation::kEast:
-      if (position_.x == x_dimen_ - 1) {
-        return false;
-      } else if (world_[position_.x][position_.y].HasEastWall() ||
-                 world_[position_.x + 1][position_.y].HasWestWall()) {
-        return false;
-      } else {
-        return true;
-      }
-      break;
-    case Orientation::kSouth:
-      if (position_.y == y_dimen_ - 1) {
-        return false;
-      } else if (world_[position_.x][position_.y].HasSouthWall() ||
-                 world_[position_.x][position_.y + 1].HasNorthWall()) {
-        return false;
-      } else {
-        return true;
-      }
-      break;
-    case Orientation::kWest:
-      if (position_.x == 0) {
-        return false;
-      } else if (world_[position_.x][position_.y].HasWestWall() ||
-                 world_[position_.x - 1][position_.y].HasEastWall()) {
-        return false;
-      } else {
-        return true;
-      }
-      break;
+  return !world_.GetCell(position_.x, position_.y).IsBlocked(orientation);
+}
+
+void Robot::MarkCellDirty(int x, int y) {
+  if (!enable_graphics_) return;
+  for (const std::pair<int, int>& cell : dirty_cells_) {
+    if (cell.first == x && cell.second == y) return;
   }
+  dirty_cells_.push_back({x, y});
 }
 
-void Robot::DrawWorld() {
-  image_.DrawRectangle(0, 0, x_dimen_ * pxPerCell, y_dimen_ * pxPerCell,
-                       kWhite);
+void Robot::Redraw() {
+  if (!enable_graphics_) {
+    image_stale_ = true;
+    return;
+  }
+  DrawDirtyCells();
+  DrawRobot();
+}
+
+void Robot::RenderImage() {
+  if (background_stale_) {
+    DrawBackground();
+  }
+  image_.Initialize(background_.GetWidth(), background_.GetHeight());
+  DrawWorld();
+  DrawRobot();
+  if (error_ != RobotError::kNoError) {
+    DrawError();
+  }
+  image_stale_ = false;
+}
+
+void Robot::DrawBackground() {
+  int min_width = 5 * pxPerCell + margin;
+  background_.Initialize(std::max(x_dimen_ * pxPerCell + margin, min_width),
+                         y_dimen_ * pxPerCell + margin);
   for (int i = 0; i <= y_dimen_; i++) {
     // Draw horizontal lines and indexes.
     int x = pxPerCell * x_dimen_;
     int y = i * pxPerCell;
-    image_.DrawLine(0, y, x, y, kGridColor, kWallThickness);
+    background_.DrawLine(0, y, x, y, kGridColor, kWallThickness);
     if (i < y_dimen_) {
-      image_.DrawText(x + fontSize / 2, y + (pxPerCell - fontSize) / 2,
-                      std::to_string(y_dimen_ - i), fontSize, kWallColor);
+      background_.DrawText(x + fontSize / 2, y + (pxPerCell - fontSize) / 2,
+                           std::to_string(y_dimen_ - i), fontSize, kWallColor);
     }
   }
   for (int i = 0; i <= x_dimen_; i++) {
     // Draw vertical lines and indexes.
     int x = i * pxPerCell;
     int y = pxPerCell * y_dimen_;
-    image_.DrawLine(x, 0, x, y, kGridColor, kWallThickness);
+    background_.DrawLine(x, 0, x, y, kGridColor, kWallThickness);
     if (i < x_dimen_) {
-      image_.DrawText(x + (pxPerCell - fontSize) / 2, y + fontSize / 2,
-                      std::to_string(i + 1), fontSize, kWallColor);
+      background_.DrawText(x + (pxPerCell - fontSize) / 2, y + fontSize / 2,
+                           std::to_string(i + 1), fontSize, kWallColor);
     }
   }
   for (int i = 0; i < x_dimen_; i++) {
@@ -638,52 +1059,89 @@ void Robot::DrawWorld() {
       int x_center = i * pxPerCell + pxPerCell / 2;
       int y_center = j * pxPerCell + pxPerCell / 2;
       // Draw the little plus at the center of the cell.
-      image_.DrawLine(x_center - markSize / 2, y_center,
-                      x_center + markSize / 2, y_center, markColor,
-                      kWallThickness);
-      image_.DrawLine(x_center, y_center - markSize / 2, x_center,
-                      y_center + markSize / 2, markColor, kWallThickness);
-      Cell& cell = world_[i][j];
-      int beeper_count = cell.GetNumBeepers();
-      if (beeper_count > 0) {
-        // Draw the beepers. Beepers are stacked so you can't tell if there's
-        // more than one in a stack.
-        // trig to get diamonds from thick lines!
-        double line_size = sqrt((beeperSize / 2) * (beeperSize / 2) / 2);
-        int inner_beeper_size = beeperSize - kWallThickness * 2;
-        double inner_line_size =
-            sqrt((inner_beeper_size / 2) * (inner_beeper_size / 2) / 2);
-        image_.DrawLine(x_center - line_size, y_center - line_size,
-                        x_center + line_size, y_center + line_size, kWallColor,
-                        beeperSize);
-        image_.DrawLine(x_center - inner_line_size, y_center - inner_line_size,
-                        x_center + inner_line_size, y_center + inner_line_size,
-                        innerBeeperColor, inner_beeper_size);
-        if (beeper_count > 1) {
-          // Draw the beeper count in the cell if it's biger than 1.
-          image_.DrawText(x_center - fontSize / 4, y_center - fontSize / 2,
-                          std::to_string(beeper_count), fontSize, kWallColor);
-        }
-      }
+      background_.DrawLine(x_center - markSize / 2, y_center,
+                           x_center + markSize / 2, y_center, markColor,
+                           kWallThickness);
+      background_.DrawLine(x_center, y_center - markSize / 2, x_center,
+                           y_center + markSize / 2, markColor, kWallThickness);
       // Draw the walls.
+      Cell cell = world_.GetCell(i, j);
       if (cell.HasNorthWall()) {
-        image_.DrawLine(i * pxPerCell, j * pxPerCell, (i + 1) * pxPerCell,
-                        j * pxPerCell, kWallColor, kWallThickness);
+        background_.DrawLine(i * pxPerCell, j * pxPerCell, (i + 1) * pxPerCell,
+                             j * pxPerCell, kWallColor, kWallThickness);
       }
       if (cell.HasSouthWall()) {
-        image_.DrawLine(i * pxPerCell, (j + 1) * pxPerCell, (i + 1) * pxPerCell,
-                        (j + 1) * pxPerCell, kWallColor, kWallThickness);
+        background_.DrawLine(i * pxPerCell, (j + 1) * pxPerCell,
+                             (i + 1) * pxPerCell, (j + 1) * pxPerCell,
+                             kWallColor, kWallThickness);
       }
       if (cell.HasWestWall()) {
-        image_.DrawLine(i * pxPerCell, j * pxPerCell, i * pxPerCell,
-                        (j + 1) * pxPerCell, kWallColor, kWallThickness);
+        background_.DrawLine(i * pxPerCell, j * pxPerCell, i * pxPerCell,
+                             (j + 1) * pxPerCell, kWallColor, kWallThickness);
       }
       if (cell.HasEastWall()) {
-        image_.DrawLine((i + 1) * pxPerCell, j * pxPerCell, (i + 1) * pxPerCell,
-                        (j + 1) * pxPerCell, kWallColor, kWallThickness);
+        background_.DrawLine((i + 1) * pxPerCell, j * pxPerCell,
+                             (i + 1) * pxPerCell, (j + 1) * pxPerCell,
+                             kWallColor, kWallThickness);
       }
     }
   }
+  background_stale_ = false;
+}
+
+void Robot::DrawWorld() {
+  image_.DrawImage(0, 0, background_);
+  for (int i = 0; i < x_dimen_; i++) {
+    for (int j = 0; j < y_dimen_; j++) {
+      DrawBeepers(i, j);
+    }
+  }
+  // Everything is up to date.
+  dirty_cells_.clear();
+}
+
+void Robot::DrawDirtyCells() {
+  for (const std::pair<int, int>& cell : dirty_cells_) {
+    DrawCell(cell.first, cell.second);
+  }
+  dirty_cells_.clear();
+}
+
+void Robot::DrawCell(int x, int y) {
+  // Copy the cell from the background including the full thickness of the
+  // lines on its edges, which Karel may have covered while moving. Nothing
+  // but the background is ever drawn on the edges.
+  const int edge = kWallThickness / 2;
+  image_.DrawImage(x * pxPerCell - edge, y * pxPerCell - edge, background_,
+                   x * pxPerCell - edge, y * pxPerCell - edge,
+                   pxPerCell + 2 * edge + 1, pxPerCell + 2 * edge + 1);
+  DrawBeepers(x, y);
+}
+
+void Robot::DrawBeepers(int x, int y) {
+  int beeper_count = world_.GetCell(x, y).GetNumBeepers();
+  if (beeper_count == 0) return;
+  if (!sprites_ready_) {
+    DrawSprites();
+  }
+  // Beepers are stacked so you can't tell if there's more than one in a
+  // stack.
+  image_.DrawImage(x * pxPerCell, y * pxPerCell, beeper_sprite_, kTransparent);
+  if (beeper_count > 1) {
+    // Draw the beeper count in the cell if it's biger than 1.
+    int x_center = x * pxPerCell + pxPerCell / 2;
+    int y_center = y * pxPerCell + pxPerCell / 2;
+    // Digits are about half the font size plus a pixel wide. Long counts
+    // are shrunk to fit in the cell, because redrawing a cell only erases
+    // the cell itself.
+    std::string text = std::to_string(beeper_count);
+    const int num_digits = static_cast<int>(text.size());
+    const int font_size =
+        std::min(fontSize, 2 * ((pxPerCell - 4) / num_digits - 1));
+    const int text_width = num_digits * (font_size / 2 + 1);
+    image_.DrawText(x_center - text_width / 2, y_center - font_size / 2, text,
+                    font_size, kWallColor);
+  }
 }
 
 void Robot::DrawRobot() {
@@ -694,72 +1152,129 @@ void Robot::DrawRobot() {
 
 // pixel_x and pixel_y are the center of the cell in pixels.
 void Robot::DrawRobot(int pixel_x, int pixel_y) {
-  image_.DrawRectangle(pixel_x - robotSize / 2, pixel_y - robotSize / 2,
-                       robotSize, robotSize, karelColor);
-  switch (position_.orientation) {
+  if (!sprites_ready_) {
+    DrawSprites();
+  }
+  image_.DrawImage(pixel_x - pxPerCell / 2, pixel_y - pxPerCell / 2,
+                   robot_sprites_[position_.orientation], kTransparent);
+}
+
+void Robot::DrawSprites() {
+  for (int i = 0; i < 4; i++) {
+    DrawRobotSprite(static_cast<Orientation>(i), &robot_sprites_[i]);
+  }
+  beeper_sprite_.Initialize(pxPerCell, pxPerCell);
+  beeper_sprite_.DrawRectangle(0, 0, pxPerCell, pxPerCell, kTransparent);
+  // Beepers are diamonds drawn from thick lines.
+  int center = pxPerCell / 2;
+  double line_size = sqrt((beeperSize / 2) * (beeperSize / 2) / 2);
+  int inner_beeper_size = beeperSize - kWallThickness * 2;
+  double inner_line_size =
+      sqrt((inner_beeper_size / 2) * (inner_beeper_size / 2) / 2);
+  beeper_sprite_.DrawLine(center - line_size, center - line_size,
+                          center + line_size, center + line_size, kWallColor,
+                          beeperSize);
+  beeper_sprite_.DrawLine(center - inner_line_size, center - inner_line_size,
+                          center + inner_line_size, center + inner_line_size,
+                          innerBeeperColor, inner_beeper_size);
+  sprites_ready_ = true;
+}
+
+void Robot::DrawRobotSprite(Orientation orientation, graphics::Image* sprite) {
+  sprite->Initialize(pxPerCell, pxPerCell);
+  sprite->DrawRectangle(0, 0, pxPerCell, pxPerCell, kTransparent);
+  // Karel is centered in the sprite.
+  int pixel_x = pxPerCell / 2;
+  int pixel_y = pxPerCell / 2;
+  sprite->DrawRectangle(pixel_x - robotSize / 2, pixel_y - robotSize / 2,
+                        robotSize, robotSize, karelColor);
+  switch (orientation) {
     case Orientation::kNorth:
-      image_.DrawCircle(pixel_x,
-                        pixel_y - robotSize / 2 + eyeSize / 2 + eyeOffset,
-                        eyeSize, kWhite);
-      image_.DrawCircle(pixel_x, pixel_y + eyeOffset, eyeSize, kWhite);
-      image_.DrawCircle(pixel_x, pixel_y - robotSize / 2 + eyeSize / 2, eyeSize,
-                        eyeColor);
-      image_.DrawLine(pixel_x + robotSize / 2, pixel_y - legLength,
-                      pixel_x + robotSize / 2 + legLength, pixel_y - legLength,
-                      limbColor, limbWidth);
-      image_.DrawLine(pixel_x + robotSize / 2, pixel_y + legLength,
-                      pixel_x + robotSize / 2 + legLength, pixel_y + legLength,
-                      limbColor, limbWidth);
+      sprite->DrawCircle(pixel_x,
+                         pixel_y - robotSize / 2 + eyeSize / 2 + eyeOffset,
+                         eyeSize, kWhite);
+      sprite->DrawCircle(pixel_x, pixel_y + eyeOffset, eyeSize, kWhite);
+      sprite->DrawCircle(pixel_x, pixel_y - robotSize / 2 + eyeSize / 2,
+                         eyeSize, eyeColor);
+      sprite->DrawLine(pixel_x + robotSize / 2, pixel_y - legLength,
+                       pixel_x + robotSize / 2 + legLength, pixel_y - legLength,
+                       limbColor, limbWidth);
+      sprite->DrawLine(pixel_x + robotSize / 2, pixel_y + legLength,
+                       pixel_x + robotSize / 2 + legLength, pixel_y + legLength,
+                       limbColor, limbWidth);
       break;
     case Orientation::kEast:
-      image_.DrawCircle(pixel_x - eyeOffset, pixel_y, eyeSize, kWhite);
-      image_.DrawCircle(pixel_x + robotSize / 2 - eyeSize / 2 - eyeOffset,
-                        pixel_y, eyeSize, kWhite);
-      image_.DrawCircle(pixel_x + robotSize / 2 - eyeSize / 2, pixel_y, eyeSize,
-                        eyeColor);
-      image_.DrawLine(pixel_x - legLength, pixel_y + robotSize / 2,
-                      pixel_x - legLength, pixel_y + robotSize / 2 + legLength,
-                      limbColor, limbWidth);
-      image_.DrawLine(pixel_x + legLength, pixel_y + robotSize / 2,
-                      pixel_x + legLength, pixel_y + robotSize / 2 + legLength,
-                      limbColor, limbWidth);
+      sprite->DrawCircle(pixel_x - eyeOffset, pixel_y, eyeSize, kWhite);
+      sprite->DrawCircle(pixel_x + robotSize / 2 - eyeSize / 2 - eyeOffset,
+                         pixel_y, eyeSize, kWhite);
+      sprite->DrawCircle(pixel_x + robotSize / 2 - eyeSize / 2, pixel_y,
+                         eyeSize, eyeColor);
+      sprite->DrawLine(pixel_x - legLength, pixel_y + robotSize / 2,
+                       pixel_x - legLength, pixel_y + robotSize / 2 + legLength,
+                       limbColor, limbWidth);
+      sprite->DrawLine(pixel_x + legLength, pixel_y + robotSize / 2,
+                       pixel_x + legLength, pixel_y + robotSize / 2 + legLength,
+                       limbColor, limbWidth);
       break;
     case Orientation::kSouth:
-      image_.DrawCircle(pixel_x,
-                        pixel_y + robotSize / 2 - eyeSize / 2 - eyeOffset,
-                        eyeSize, kWhite);
-      image_.DrawCircle(pixel_x, pixel_y - eyeOffset, eyeSize, kWhite);
-      image_.DrawCircle(pixel_x, pixel_y + robotSize / 2 - eyeSize / 2, eyeSize,
-                        eyeColor);
-      image_.DrawLine(pixel_x - robotSize / 2, pixel_y - legLength,
-                      pixel_x - robotSize / 2 - legLength, pixel_y - legLength,
-                      limbColor, limbWidth);
-      image_.DrawLine(pixel_x - robotSize / 2, pixel_y + legLength,
-                      pixel_x - robotSize / 2 - legLength, pixel_y + legLength,
-                      limbColor, limbWidth);
+      sprite->DrawCircle(pixel_x,
+                         pixel_y + robotSize / 2 - eyeSize / 2 - eyeOffset,
+                         eyeSize, kWhite);
+      sprite->DrawCircle(pixel_x, pixel_y - eyeOffset, eyeSize, kWhite);
+      sprite->DrawCircle(pixel_x, pixel_y + robotSize / 2 - eyeSize / 2,
+                         eyeSize, eyeColor);
+      sprite->DrawLine(pixel_x - robotSize / 2, pixel_y - legLength,
+                       pixel_x - robotSize / 2 - legLength, pixel_y - legLength,
+                       limbColor, limbWidth);
+      sprite->DrawLine(pixel_x - robotSize / 2, pixel_y + legLength,
+                       pixel_x - robotSize / 2 - legLength, pixel_y + legLength,
+                       limbColor, limbWidth);
       break;
     case Orientation::kWest:
-      image_.DrawCircle(pixel_x + eyeOffset, pixel_y, eyeSize, kWhite);
-      image_.DrawCircle(pixel_x - robotSize / 2 + eyeSize / 2 + eyeOffset,
-                        pixel_y, eyeSize, kWhite);
-      image_.DrawCircle(pixel_x - robotSize / 2 + eyeSize / 2, pixel_y, eyeSize,
-                        eyeColor);
-      image_.DrawLine(pixel_x - legLength, pixel_y - robotSize / 2,
-                      pixel_x - legLength, pixel_y - robotSize / 2 - legLength,
-                      limbColor, limbWidth);
-      image_.DrawLine(pixel_x + legLength, pixel_y - robotSize / 2,
-                      pixel_x + legLength, pixel_y - robotSize / 2 - legLength,
-                      limbColor, limbWidth);
+      sprite->DrawCircle(pixel_x + eyeOffset, pixel_y, eyeSize, kWhite);
+      sprite->DrawCircle(pixel_x - robotSize / 2 + eyeSize / 2 + eyeOffset,
+                         pixel_y, eyeSize, kWhite);
+      sprite->DrawCircle(pixel_x - robotSize / 2 + eyeSize / 2, pixel_y,
+                         eyeSize, eyeColor);
+      sprite->DrawLine(pixel_x - legLength, pixel_y - robotSize / 2,
+                       pixel_x - legLength, pixel_y - robotSize / 2 - legLength,
+                       limbColor, limbWidth);
+      sprite->DrawLine(pixel_x + legLength, pixel_y - robotSize / 2,
+                       pixel_x + legLength, pixel_y - robotSize / 2 - legLength,
+                       limbColor, limbWidth);
       break;
   }
-  image_.DrawCircle(pixel_x, pixel_y, eyeSize, eyeColor);
+  sprite->DrawCircle(pixel_x, pixel_y, eyeSize, eyeColor);
 }
 
 void Robot::AnimateMove(int next_x, int next_y) {
-  int steps = enable_graphics_ ? kNumAnimationSteps : 0;
-  for (int i = 1; i <= steps; i++) {
-    DrawWorld();
-    double fraction = i * 1.0 / steps;
+  if (!enable_graphics_ || turbo_mode_) {
+    // No animation frames when headless or in turbo mode.
+    MarkCellDirty(position_.x, position_.y);
+    MarkCellDirty(next_x, next_y);
+    position_.x = next_x;
+    position_.y = next_y;
+    Redraw();
+    Show(/* long duration */ true);
+    return;
+  }
+  // Karel's position is interpolated from the time elapsed, so the move
+  // takes the same time however long each frame takes to draw. Slow frames
+  // make Karel jump further instead of making the move longer.
+  double frame_ms = kShortDuration / speed_;
+  double duration_ms = kNumAnimationSteps * frame_ms;
+  auto start = std::chrono::steady_clock::now();
+  double fraction = 0;
+  while (fraction < 1) {
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    // Draw where Karel will be by the end of this frame.
+    fraction = std::min(1.0, (elapsed.count() + frame_ms) / duration_ms);
+    // Karel only ever covers the cell they are leaving, the cell they are
+    // entering and the grid line between them.
+    MarkCellDirty(position_.x, position_.y);
+    MarkCellDirty(next_x, next_y);
+    DrawDirtyCells();
     double x = position_.x * (1 - fraction) + next_x * fraction;
     double y = position_.y * (1 - fraction) + next_y * fraction;
     DrawRobot(x * pxPerCell + pxPerCell / 2, y * pxPerCell + pxPerCell / 2);
@@ -780,11 +1295,13 @@ void Robot::PromptBeforeActionIfNeeded() {
 // Note that the orientation is not populated. This is just a helper to
 // get the x and y position from a file with the next items in the stream
 // being (x, y)
-PositionAndOrientation Robot::ParsePosition(std::fstream& file,
+PositionAndOrientation Robot::ParsePosition(WorldReader* reader,
                                             int line_number) const {
   char open_paren, comma, closed_paren;
   int x, y;
-  if (!(file >> open_paren >> x >> comma >> y >> closed_paren)) {
+  if (!(reader->ReadChar(&open_paren) && reader->ReadInt(&x) &&
+        reader->ReadChar(&comma) && reader->ReadInt(&y) &&
+        reader->ReadChar(&closed_paren))) {
     ParseWorldFileError("Error reading position", line_number);
   }
   CheckParsePosition(open_paren, comma, closed_paren, line_number);
@@ -801,12 +1318,14 @@ PositionAndOrientation Robot::ParsePosition(std::fstream& file,
 // (3, 7) East
 // Direction may be lower-case or have an uppercase first letter.
 PositionAndOrientation Robot::ParsePositionAndOrientation(
-    std::fstream& file, int line_number) const {
-  PositionAndOrientation result = ParsePosition(file, line_number);
-  std::string direction;
-  if (!(file >> direction)) {
+    WorldReader* reader, int line_number) const {
+  PositionAndOrientation result = ParsePosition(reader, line_number);
+  std::string_view token;
+  if (!reader->ReadToken(&token)) {
     ParseWorldFileError("Error reading orientation", line_number);
   }
+  // Short enough not to allocate.
+  std::string direction(token);
   // Ensure the first character is lower cased.
   direction[0] = tolower(direction[0]);
   if (direction == "north") {
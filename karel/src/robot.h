@@ -4,39 +4,93 @@
 // license that can be found in the LICENSE file or at
 // https://opensource.org/licenses/MIT.
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
 #include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "../../graphics/image.h"
 #include "cell.h"
+#include "csv_log.h"
 #include "error.h"
 #include "orientation.h"
+#include "stats.h"
+#include "trace.h"
+#include "world.h"
+#include "world_reader.h"
 
 #ifndef ROBOT_H
 #define ROBOT_H
 
 namespace karel {
 
+/**
+ * A saved state of a Robot and its world, see Robot::TakeSnapshot. Cheap to
+ * keep many of: snapshots share unchanged parts of the world.
+ */
+struct RobotSnapshot {
+  World world;
+  PositionAndOrientation position;
+  int beepers_in_bag = 0;
+  RobotError error = RobotError::kNoError;
+  bool finished = false;
+  int64_t num_actions = 0;
+};
+
 class Robot {
  public:
   /**
-   * Get the Robot singleton. Initializes it with default values if it isn't
-   * already initialized. Set |enable_graphics| to false for testing, which
-   * will disable animations. Use |force_initialize| only for testing which
-   * resets the singleton state.
+   * Creates a Robot which is independent of the singleton, for example to
+   * simulate several worlds in one process. Call LoadWorld before using it.
+   * Student programs should use GetInstance instead.
+   */
+  Robot();
+
+  /**
+   * Get the current Robot: the one bound to this thread with
+   * SetCurrentInstance, or the singleton if none is bound. Initializes it
+   * with default values if it isn't already initialized. Set
+   * |enable_graphics| to false for testing, which will disable animations.
+   * Use |force_initialize| only for testing which resets the robot's state.
    */
   static karel::Robot& GetInstance(bool enable_graphics = true,
                                    bool force_initialize = false);
 
   /**
-   * Get the Robot singleton and intialize it from a file. Set |enable_graphics|
-   * to false for testing, which will disable animations. Use |force_initialize|
-   * only for testing which resets the singleton state.
+   * Get the current Robot and intialize it from a file. Set |enable_graphics|
+   * to false for testing, which will disable animations. Use
+   * |force_initialize| only for testing which resets the robot's state.
    */
   static karel::Robot& InitializeInstance(std::string filename,
                                           bool enable_graphics = true,
                                           bool force_initialize = false);
 
+  /**
+   * Binds |robot| to the calling thread, so that GetInstance and the Karel
+   * functions in karel.h (Move(), FrontIsClear(), ...) use it on this thread.
+   * Pass nullptr to go back to the singleton. |robot| is unowned and must
+   * outlive the binding.
+   */
+  static void SetCurrentInstance(karel::Robot* robot);
+
+  /**
+   * Resets this robot and loads a Karel world from a text or binary world
+   * file, or the default world if |filename| is empty. Throws a std::string
+   * describing the problem if the file cannot be loaded.
+   */
+  void LoadWorld(std::string filename, bool enable_graphics = true);
+
+  /**
+   * Like LoadWorld, but parses the world file's |contents| from memory.
+   */
+  void LoadWorldFromString(const std::string& contents,
+                           bool enable_graphics = true);
+
   // Disallow copy and assignment.
   Robot(const Robot&) = delete;
   karel::Robot& operator=(const Robot&) = delete;
@@ -59,7 +113,8 @@ class Robot {
 
   /**
    * Places a beeper from Karel's beeper bag onto the current cell where Karel
-   * is. Results in an error if Karel has no beepers left in their bag.
+   * is. Results in an error if Karel has no beepers left in their bag or the
+   * cell already holds Cell::kMaxBeepers.
    */
   void PutBeeper();
 
@@ -73,51 +128,51 @@ class Robot {
   /**
    * Returns true if Karel has beepers in their bag, or false otherwise.
    */
-  bool HasBeepersInBag() const;
+  bool HasBeepersInBag();
 
   /**
    * Returns true if Karel is standing on a cell with at least one beeper, or
    * false otherwise.
    */
-  bool BeepersPresent() const;
+  bool BeepersPresent();
 
   /**
    * Returns true if there is no wall nor edge in front of Karel and they could
    * move forward, or false otherwise.
    */
-  bool FrontIsClear() const;
+  bool FrontIsClear();
 
   /**
    * Returns true if there is no wall nor edge directly to Karel's left, or
    * false otherwise.
    */
-  bool LeftIsClear() const;
+  bool LeftIsClear();
 
   /**
    * Returns true if there is no wall nor edge directly to Karel's right, or
    * false otherwise.
    */
-  bool RightIsClear() const;
+  bool RightIsClear();
 
   /**
    * Returns true if Karel is facing north or false otherwise.
    */
-  bool FacingNorth() const;
+  bool FacingNorth();
 
   /**
    * Returns true if Karel is facing east or false otherwise.
    */
-  bool FacingEast() const;
+  bool FacingEast();
 
   /**
    * Returns true if Karel is facing south or false otherwise.
    */
-  bool FacingSouth() const;
+  bool FacingSouth();
 
   /**
    * Returns true if Karel is facing west or false otherwise.
    */
-  bool FacingWest() const;
+  bool FacingWest();
 
   /**
    * Completes a Karel program. Continues to show the image but will not
@@ -125,6 +180,84 @@ class Robot {
    */
   void Finish();
 
+  /**
+   * Saves the world's cells and Karel's position, orientation, bag, error
+   * and action count. Takes time proportional to the number of world chunks
+   * rather than cells, and the world is then only copied where it changes.
+   */
+  RobotSnapshot TakeSnapshot() const;
+
+  /**
+   * Returns the world and Karel to a snapshot taken by any Robot, which may
+   * be from another world, and redraws them. Steps taken still count toward
+   * the step budget.
+   */
+  void RestoreSnapshot(const RobotSnapshot& snapshot);
+
+  /**
+   * Limits the number of steps Karel may take, where a step is an action
+   * (Move, TurnLeft, PutBeeper, PickBeeper) or a sensor query (FrontIsClear,
+   * BeepersPresent, FacingNorth, ...), including steps taken after Karel
+   * finished. When the budget is used up Karel stops with
+   * kStepBudgetExceeded and the RobotError is thrown so that the program
+   * stops running. |max_steps| of 0, the default, means no limit.
+   */
+  void SetStepBudget(int64_t max_steps);
+
+  /**
+   * Detects programs stuck in an infinite loop. Karel stops with
+   * kInfiniteLoop and the RobotError is thrown when the world (Karel's
+   * position, orientation and bag, and the beepers) returns to the same state
+   * more than |max_repeats| times, or when more than 1000 sensor queries are
+   * made in a row without an action. |max_repeats| of 0, the default,
+   * disables detection.
+   *
+   * States are counted in a fixed table of 65536 entries, which takes 1 MiB
+   * while detection is on however long the program runs. A state evicts
+   * another state that maps to the same entry, so a loop through a very
+   * large number of states may go undetected; use SetStepBudget to bound
+   * those.
+   */
+  void SetLoopDetection(int max_repeats);
+
+  /**
+   * Starts recording every action and sensor query into |trace|, which must
+   * outlive the recording. Start recording right after loading the world so
+   * the trace can be replayed from that world.
+   */
+  void StartRecording(Trace* trace);
+
+  /**
+   * Stops recording into the current trace, if any.
+   */
+  void StopRecording();
+
+  /**
+   * Replays the first |num_records| records of |trace| on this robot, which
+   * should have just loaded the world the trace was recorded in. This
+   * reconstructs Karel's world as it was after that many steps, and draws it
+   * when graphics are enabled.
+   *
+   * Returns false if a replayed action or sensor query gave a different
+   * result than the recorded one, meaning the trace does not belong to this
+   * world.
+   */
+  bool ReplayTrace(const Trace& trace, size_t num_records);
+
+  /**
+   * Shows the world at most once per 16 ms (one 60 Hz screen refresh)
+   * instead of pausing after each action, and skips the animation frames
+   * between cells. Consecutive actions within one refresh are
+   * coalesced into a single frame.
+   */
+  void EnableTurboMode();
+
+  /**
+   * Sets the animation speed multiplier, like the Speed: line in a world
+   * file. Larger is faster. Speeds below 0.1 are raised to 0.1.
+   */
+  void SetSpeed(double speed);
+
   /**
    * Causes Robot to wait between each action function (Move, TurnLeft,
    * PutBeeper, PickBeeper) until the user enters input into the terminal to
@@ -139,6 +272,43 @@ class Robot {
    */
   void EnableCSVOutput();
 
+  /**
+   * Enables incremental CSV output, a faster alternative to EnableCSVOutput
+   * for large worlds and long runs which does not prompt between actions.
+   * Rather than rewriting karel.csv, each action appends only the cells that
+   * changed to karel_log.csv, which stays open. The whole world is appended
+   * when the log starts, every |snapshot_interval| actions (unless 0) and when
+   * Karel finishes. If |use_background_thread| is true the file is written on
+   * another thread so that actions do not wait for the disk.
+   *
+   * The log starts with the legend, followed by records which are either
+   * "snapshot,<actions>" and the grid in the same format as karel.csv, or
+   * "step,<actions>" and one line per changed cell.
+   */
+  void EnableIncrementalCSVOutput(int snapshot_interval = 100,
+                                  bool use_background_thread = false);
+
+  /**
+   * Writes the counters from GetStats as JSON to |filename| when Karel
+   * finishes, including when they stop with an error. Also enables visit
+   * counts.
+   */
+  void EnableStatsOutput(std::string filename = "karel_stats.json");
+
+  /**
+   * Counts how many times Karel enters each cell in GetStats, starting with
+   * the cell Karel is in, until another world is loaded. Dense worlds take 4
+   * bytes per cell for the counts, so they are off by default.
+   */
+  void EnableVisitCounts();
+
+  /**
+   * Sets how worlds loaded from now on store their cells. Use
+   * WorldStorage::kSparse for huge worlds with few walls and beepers, with
+   * graphics disabled. Defaults to WorldStorage::kDense.
+   */
+  void SetWorldStorage(WorldStorage storage);
+
   ///////////////////////////////////////////////////////////////////////
   //   Methods for tests. Tests should access Robot with GetInstance   //
   //   and may inspect its state with the following methods.           //
@@ -168,10 +338,11 @@ class Robot {
   int GetNumBeepersInBag() const;
 
   /**
-   * Gets the current grid. Takes in grid coordinates, where (1, 1) is the
-   * bottom left cell.
+   * Gets the cell at (x, y). Takes in grid coordinates, where (1, 1) is the
+   * bottom left cell. Cells are returned by value because the world may move
+   * or remove a cell when it changes.
    */
-  const Cell& GetCell(int x, int y) const;
+  Cell GetCell(int x, int y) const;
 
   /**
    * Gets the width of the current world.
@@ -188,16 +359,73 @@ class Robot {
    */
   RobotError GetError() const;
 
+  /**
+   * Gets the number of actions (Move, TurnLeft, PutBeeper and PickBeeper)
+   * Karel has taken since the world was loaded.
+   */
+  int64_t GetNumActions() const;
+
+  /**
+   * Gets the animation speed multiplier.
+   */
+  double GetSpeed() const;
+
+  /**
+   * Gets the number of steps, actions and sensor queries, taken since the
+   * world was loaded.
+   */
+  int64_t GetNumSteps() const;
+
+  /**
+   * Gets a hash of the current state: the world's walls and beepers and
+   * Karel's position, orientation and bag. Maintained incrementally, so this
+   * is O(1).
+   */
+  uint64_t GetStateHash() const;
+
+  /**
+   * Gets counts of each action and sensor query, frames shown and visits to
+   * each cell since the world was loaded. Snapshots restored from a world of
+   * the same size keep counting.
+   */
+  const RobotStats& GetStats() const;
+
+  /**
+   * Returns true if the current world's walls and beepers match those in
+   * |expected|. Karel's position and bag are not compared. Worlds are
+   * compared in O(1) by their 64-bit hashes (see World::Matches), so a hash
+   * collision gives a false match, though with negligible probability. When
+   * the worlds differ, up to
+   * |max_differences| differing cells are appended to |differences|, unless
+   * it is null, with x and y in grid coordinates where (1, 1) is the bottom
+   * left cell.
+   */
+  bool WorldMatches(const RobotSnapshot& expected, size_t max_differences = 0,
+                    std::vector<CellDifference>* differences = nullptr) const;
+
+  /**
+   * Like WorldMatches, but compares with the world in a text or binary world
+   * file. Throws a std::string if the file cannot be loaded.
+   */
+  bool WorldMatchesFile(
+      std::string filename, size_t max_differences = 0,
+      std::vector<CellDifference>* differences = nullptr) const;
+
   /**
    * Saves an image of Karel's world with the given filename in .bmp format.
+   * When graphics are disabled the image is only rendered here, on demand.
    */
-   void SaveWorldBmp(std::string filename) const;
+  void SaveWorldBmp(std::string filename);
 
- private:
-  // Private constructor: Robot can only be accessed with GetInstance.
-  Robot();
+  /**
+   * Saves the current world, including Karel, in the binary world format
+   * (see binary_world.h), which LoadWorld loads much faster than a text
+   * world. Throws a std::string if the file cannot be written.
+   */
+  void SaveWorldBinary(std::string filename) const;
 
-  // Singleton.
+ private:
+  // The robot bound to this thread, or the singleton.
   static karel::Robot& PrivateGetInstance();
 
   /**
@@ -207,6 +435,27 @@ class Robot {
   void Initialize(std::string filename, bool enable_graphics,
                   bool force_initialize);
 
+  /**
+   * Resets Karel's state before a world is loaded.
+   */
+  void ResetState(bool enable_graphics, bool force_initialize);
+
+  /**
+   * Parses a world file, throwing a std::string if it is invalid.
+   */
+  void ParseWorld(WorldReader* reader);
+
+  /**
+   * Loads a world saved by SaveWorldBinary, throwing a std::string if it is
+   * invalid.
+   */
+  void LoadBinaryWorld(const char* data, size_t size);
+
+  /**
+   * Prepares the loaded world to be shown.
+   */
+  void FinishLoading();
+
   /**
    * Shows karel's world, blocking for a long duration or a short duration.
    * If long_duration, may also print to the terminal when EnableTerminalOutput
@@ -214,25 +463,136 @@ class Robot {
    */
   void Show(bool long_duration);
 
+  /**
+   * Shows the image until |milliseconds| after the previous frame's
+   * deadline, so time spent drawing this frame is not added to the wait.
+   */
+  void PresentFrame(double milliseconds);
+
   /**
    * Writes the world to a CSV file.
    */
   void WriteWorldCSV();
 
+  /**
+   * Writes the stats to |stats_filename_|.
+   */
+  void WriteStats();
+
+  /**
+   * Appends the world grid and error message in CSV format to |csv|.
+   */
+  void AppendWorldCSV(std::string* csv) const;
+
+  /**
+   * Appends the quoted CSV description of the cell at (x, y) to |csv|.
+   */
+  void AppendCellCSV(int x, int y, std::string* csv) const;
+
+  /**
+   * Appends the changes since the last call, or the whole world if
+   * |snapshot| is true or a periodic snapshot is due, to the CSV log.
+   */
+  void AppendCSVLog(bool snapshot);
+
   /**
    * Displays an error and finishes the program.
    */
   void Error(RobotError error);
 
+  /**
+   * Counts |op| and adds a record to the trace, if recording.
+   */
+  void Record(TraceOp op, bool result) {
+    stats_.Count(op);
+    if (trace_ != nullptr) {
+      trace_->Append(op, result);
+    }
+  }
+
+  /**
+   * Counts an action or sensor query toward the step budget and loop
+   * detection, aborting if either is exceeded.
+   */
+  void CountStep(bool is_action);
+
+  /**
+   * Called after each completed action to check whether the new state has
+   * been repeated too many times.
+   */
+  void CheckForLoop();
+
+  /**
+   * Stops Karel with |error|, unless already finished, and throws it to stop
+   * the running program.
+   */
+  void Abort(RobotError error);
+
   /**
    * Helper method to see if a compass direction is clear.
    */
   bool DirectionIsClear(Orientation orientation) const;
 
+  /**
+   * Redraws the world and Karel after an action. Does no drawing when graphics
+   * are disabled, instead marking the image as stale.
+   */
+  void Redraw();
+
+  /**
+   * Renders the whole image from scratch: the world, Karel and any error.
+   */
+  void RenderImage();
+
+  /**
+   * Draws the parts of the world which never change after it is loaded into
+   * |background_|: grid lines, indexes, center marks and walls.
+   */
+  void DrawBackground();
+
+  /**
+   * Draws the whole world by copying the background and adding beepers.
+   */
   void DrawWorld();
 
+  /**
+   * Records that the cell at (x, y) in world coordinates must be repainted on
+   * the next Redraw.
+   */
+  void MarkCellDirty(int x, int y);
+
+  /**
+   * Repaints only the cells which changed since they were last drawn.
+   */
+  void DrawDirtyCells();
+
+  /**
+   * Repaints a single cell from the background, including its edges.
+   */
+  void DrawCell(int x, int y);
+
+  /**
+   * Draws the beepers in a cell, if it has any.
+   */
+  void DrawBeepers(int x, int y);
+
+  /**
+   * Renders the robot and beeper sprites.
+   */
+  void DrawSprites();
+
+  /**
+   * Draws Karel facing |orientation| into the center of a blank |sprite|.
+   */
+  void DrawRobotSprite(Orientation orientation, graphics::Image* sprite);
+
   void DrawRobot();
 
+  /**
+   * Draws the current error message over the center of the world.
+   */
+  void DrawError();
+
   /**
    * Draws Karel at a location on the image. |pixel_x| and |pixel_y| are the
    * center of the cell in pixels.
@@ -244,19 +604,21 @@ class Robot {
   void PromptBeforeActionIfNeeded();
 
   /**
-   * Helper method to parse position from the next item in a file stream.
+   * Helper method to parse position from the next items in a world file.
    * Note that the orientation is not populated. This is just a helper to
-   * get the x and y position from a file with the next items in the stream
+   * get the x and y position from a file with the next items in the reader
    * being (x, y)
    */
-  PositionAndOrientation ParsePosition(std::fstream& file, int line_number) const;
+  PositionAndOrientation ParsePosition(WorldReader* reader,
+                                       int line_number) const;
 
   /**
    * Helper to get orientation of the form, `(x, y) direction`, for example,
    * (3, 7) East
    * Direction may be lower-case or have an uppercase first letter.
    */
-  PositionAndOrientation ParsePositionAndOrientation(std::fstream& file, int line_number) const;
+  PositionAndOrientation ParsePositionAndOrientation(WorldReader* reader,
+                                                     int line_number) const;
 
   // Whether graphics are enabled. They should probably be disabled for
   // testing.
@@ -269,12 +631,49 @@ class Robot {
   // Whether to enable terminal output -- a text-based display of Karel's world.
   bool enable_csv_output_ = false;
 
+  // The incremental CSV log, or nullptr if it is not enabled. Also Karel's
+  // position when it was last written, whether the first snapshot has been
+  // written and how many records have been appended since the last snapshot.
+  std::unique_ptr<CSVLog> csv_log_;
+  PositionAndOrientation csv_last_position_;
+  bool csv_log_started_ = false;
+  int csv_snapshot_interval_ = 0;
+  int csv_changes_since_snapshot_ = 0;
+
   // Speed multiplier for animation.
   double speed_ = 1.0;
 
+  // Whether to skip animation and limit frames to one per screen refresh, and
+  // when the last frame was shown in turbo mode.
+  bool turbo_mode_ = false;
+  std::chrono::steady_clock::time_point last_frame_time_;
+
+  // When the frame currently shown should be replaced by the next one.
+  std::chrono::steady_clock::time_point frame_deadline_;
+
   // Underlying image.
   graphics::Image image_;
 
+  // Pre-rendered static parts of the world, copied into |image_| before
+  // beepers and Karel are drawn.
+  graphics::Image background_;
+
+  // Karel facing each orientation, and a beeper, one cell in size. Pixels
+  // which are not part of the sprite are kTransparent.
+  graphics::Image robot_sprites_[4];
+  graphics::Image beeper_sprite_;
+  bool sprites_ready_ = false;
+
+  // Whether |background_| must be redrawn because a new world was loaded.
+  bool background_stale_ = true;
+
+  // Whether |image_| is out of date with the world. Only used when graphics
+  // are disabled, in which case the image is rendered lazily.
+  bool image_stale_ = true;
+
+  // Cells in world coordinates which changed since the image was drawn.
+  std::vector<std::pair<int, int>> dirty_cells_;
+
   // Grid dimensions.
   int x_dimen_;
   int y_dimen_;
@@ -285,8 +684,40 @@ class Robot {
   // Karel's beeper bag.
   int beeper_count_ = 0;
 
-  // The cells in the world.
-  std::vector<std::vector<Cell>> world_;
+  // Number of actions taken since the world was loaded.
+  int64_t num_actions_ = 0;
+
+  // Number of actions and sensor queries since the world was loaded, and the
+  // most allowed, or 0 for no limit.
+  int64_t num_steps_ = 0;
+  int64_t step_budget_ = 0;
+
+  // Loop detection: the most times a state may repeat, or 0 if disabled, the
+  // number of times each state was seen, and sensor queries since the last
+  // action. Sensors cannot change between actions, so no correct program
+  // needs anywhere near kMaxQueriesWithoutAction queries in a row.
+  static constexpr int kMaxQueriesWithoutAction = 1000;
+  struct StateVisits {
+    uint64_t hash = 0;
+    int visits = 0;
+  };
+  static constexpr int kStateTableBits = 16;
+  int max_repeats_ = 0;
+  std::vector<StateVisits> state_visits_;
+  int queries_since_action_ = 0;
+
+  // Where actions and sensor queries are recorded, or nullptr.
+  Trace* trace_ = nullptr;
+
+  // Counters for this run, and the file they are written to when Karel
+  // finishes, or empty if they are not written.
+  RobotStats stats_;
+  std::string stats_filename_;
+  bool count_visits_ = false;
+
+  // The cells in the world, and how they are stored.
+  World world_;
+  WorldStorage world_storage_ = WorldStorage::kDense;
 
   // Whether the world has been initialized. It will not re-initialize.
   bool initialized_ = false;
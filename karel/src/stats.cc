@@ -0,0 +1,107 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "stats.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "trace.h"
+#include "world.h"
+
+namespace karel {
+
+namespace {
+
+// JSON names of each TraceOp. The first four are actions, the rest sensors.
+const char* const kOpNames[kNumTraceOps] = {
+    "move",           "turn_left",          "put_beeper",
+    "pick_beeper",    "has_beepers_in_bag", "beepers_present",
+    "front_is_clear", "left_is_clear",      "right_is_clear",
+    "facing_north",   "facing_east",        "facing_south",
+    "facing_west"};
+const int kNumActionOps = 4;
+
+// Appends "name":count pairs for ops in [first, last) to |json|.
+void AppendOpCounts(const int64_t* counts, int first, int last,
+                    std::string* json) {
+  *json += '{';
+  for (int op = first; op < last; op++) {
+    if (op > first) *json += ',';
+    *json += '"';
+    *json += kOpNames[op];
+    *json += "\":" + std::to_string(counts[op]);
+  }
+  *json += '}';
+}
+
+}  // namespace
+
+void RobotStats::Reset(int width, int height, WorldStorage storage) {
+  width_ = width;
+  height_ = height;
+  storage_ = storage;
+  std::fill(op_counts_, op_counts_ + kNumTraceOps, 0);
+  frames_ = 0;
+  count_visits_ = false;
+  // Release the memory rather than keeping it for the next world.
+  std::vector<uint32_t>().swap(visits_);
+  sparse_visits_.clear();
+}
+
+void RobotStats::EnableVisits() {
+  if (count_visits_) return;
+  count_visits_ = true;
+  if (storage_ == WorldStorage::kDense) {
+    visits_.resize(static_cast<size_t>(width_) * height_);
+  }
+}
+
+int64_t RobotStats::GetNumVisits(int x, int y) const {
+  if (!count_visits_) return 0;
+  size_t index = static_cast<size_t>(y) * width_ + x;
+  if (storage_ == WorldStorage::kDense) return visits_[index];
+  auto it = sparse_visits_.find(index);
+  return it == sparse_visits_.end() ? 0 : it->second;
+}
+
+std::string RobotStats::ToJSON() const {
+  std::string json = "{\"actions\":";
+  AppendOpCounts(op_counts_, 0, kNumActionOps, &json);
+  json += ",\"sensors\":";
+  AppendOpCounts(op_counts_, kNumActionOps, kNumTraceOps, &json);
+  json += ",\"frames\":" + std::to_string(frames_);
+  json += ",\"width\":" + std::to_string(width_);
+  json += ",\"height\":" + std::to_string(height_);
+
+  // Visited cells in row-major order.
+  std::vector<std::pair<size_t, uint32_t>> visited;
+  if (storage_ == WorldStorage::kDense) {
+    for (size_t index = 0; index < visits_.size(); index++) {
+      if (visits_[index] > 0) visited.push_back({index, visits_[index]});
+    }
+  } else {
+    visited.assign(sparse_visits_.begin(), sparse_visits_.end());
+    std::sort(visited.begin(), visited.end());
+  }
+  json += ",\"visits\":[";
+  for (size_t i = 0; i < visited.size(); i++) {
+    if (i > 0) json += ',';
+    int x = static_cast<int>(visited[i].first % width_);
+    int y = static_cast<int>(visited[i].first / width_);
+    json += '[' + std::to_string(x + 1) + ',' + std::to_string(height_ - y) +
+            ',' + std::to_string(visited[i].second) + ']';
+  }
+  json += "]}\n";
+  return json;
+}
+
+}  // namespace karel
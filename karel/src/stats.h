@@ -0,0 +1,106 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "trace.h"
+#include "world.h"
+
+#ifndef STATS_H
+#define STATS_H
+
+namespace karel {
+
+/**
+ * Counters describing what a Karel program did: how many times it took each
+ * action and made each sensor query, how many frames were shown and, if
+ * enabled, how many times Karel entered each cell. Counting is a few
+ * increments per step, so the action, sensor and frame counts are always
+ * collected. Visits cost memory per cell, so they are only counted on
+ * request.
+ *
+ * Cells are in world coordinates, where (0, 0) is the top left cell.
+ */
+class RobotStats {
+ public:
+  /**
+   * Clears all counters for a |width| by |height| world, and stops counting
+   * visits.
+   */
+  void Reset(int width, int height, WorldStorage storage);
+
+  /**
+   * Starts counting visits, if not already, without clearing the other
+   * counters. Visits are counted in an array of 4 bytes per cell for dense
+   * worlds, or only for visited cells for sparse ones.
+   */
+  void EnableVisits();
+
+  bool CountsVisits() const { return count_visits_; }
+
+  /**
+   * Counts an action or sensor query, whether or not it succeeded.
+   */
+  void Count(TraceOp op) { op_counts_[static_cast<int>(op)]++; }
+
+  void CountFrame() { frames_++; }
+
+  /**
+   * Counts Karel entering the cell at (x, y).
+   */
+  void Visit(int x, int y) {
+    if (!count_visits_) return;
+    size_t index = static_cast<size_t>(y) * width_ + x;
+    uint32_t& visits = storage_ == WorldStorage::kDense
+                           ? visits_[index]
+                           : sparse_visits_[index];
+    // Saturate rather than wrap in extremely long runs.
+    if (visits != UINT32_MAX) visits++;
+  }
+
+  int64_t GetCount(TraceOp op) const {
+    return op_counts_[static_cast<int>(op)];
+  }
+
+  int64_t GetNumFrames() const { return frames_; }
+
+  int GetWidth() const { return width_; }
+  int GetHeight() const { return height_; }
+
+  /**
+   * Returns how many times Karel entered the cell at (x, y), including being
+   * there when visits started being counted, or 0 if visits are not
+   * counted.
+   */
+  int64_t GetNumVisits(int x, int y) const;
+
+  /**
+   * Returns the stats as a JSON object with "actions" and "sensors" objects
+   * holding the count for each, "frames", and "visits", an array of
+   * [x, y, count] for each visited cell in grid coordinates, where (1, 1) is
+   * the bottom left cell, which is empty if visits are not counted.
+   */
+  std::string ToJSON() const;
+
+ private:
+  int width_ = 0;
+  int height_ = 0;
+  WorldStorage storage_ = WorldStorage::kDense;
+  int64_t op_counts_[kNumTraceOps] = {};
+  int64_t frames_ = 0;
+  bool count_visits_ = false;
+  std::vector<uint32_t> visits_;
+  std::unordered_map<size_t, uint32_t> sparse_visits_;
+};
+
+}  // namespace karel
+
+#endif  // STATS_H
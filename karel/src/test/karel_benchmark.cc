@@ -0,0 +1,92 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+// Measures how quickly large world files load. Run with an optional number
+// of lines, for example ./karel_benchmark 1000000.
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+
+#include "../robot.h"
+
+namespace {
+
+const char kWorldFilename[] = "benchmark_world.w";
+const char kBinaryWorldFilename[] = "benchmark_world.kw";
+const int kDefaultNumLines = 500000;
+const int kNumRuns = 5;
+
+// Builds a square world with |num_lines| Wall: and Beeper: lines.
+std::string GenerateWorld(int num_lines) {
+  int size = 1;
+  while (size * size < num_lines) {
+    size++;
+  }
+  const char* directions[] = {"north", "East", "south", "West"};
+  std::string world = "Dimension: (" + std::to_string(size) + ", " +
+                      std::to_string(size) + ")\n";
+  for (int i = 0; i < num_lines; i++) {
+    std::string position = "(" + std::to_string(i % size + 1) + ", " +
+                           std::to_string(i / size + 1) + ")";
+    if (i % 2 == 0) {
+      world += "Wall: " + position + " " + directions[i % 4] + "\n";
+    } else {
+      world += "Beeper: " + position + " " + std::to_string(i % 9 + 1) + "\n";
+    }
+  }
+  world += "BeeperBag: INFINITY\nKarel: (1, 1) East\nSpeed: 0.75\n";
+  return world;
+}
+
+// Reports the best of several runs of |load| in lines per second.
+void Report(const std::string& name, int num_lines,
+            const std::function<void()>& load) {
+  double best_seconds = 0;
+  for (int i = 0; i < kNumRuns; i++) {
+    auto start = std::chrono::steady_clock::now();
+    load();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    if (i == 0 || elapsed.count() < best_seconds) {
+      best_seconds = elapsed.count();
+    }
+  }
+  std::cout << name << ": " << best_seconds * 1000 << " ms, "
+            << static_cast<int64_t>(num_lines / best_seconds)
+            << " lines/sec" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int num_lines = argc > 1 ? atoi(argv[1]) : kDefaultNumLines;
+  std::string world = GenerateWorld(num_lines);
+  std::ofstream file(kWorldFilename);
+  file << world;
+  file.close();
+
+  karel::Robot robot;
+  Report("LoadWorld (mapped file)", num_lines, [&robot]() {
+    robot.LoadWorld(kWorldFilename, /* enable graphics */ false);
+  });
+  Report("LoadWorldFromString", num_lines, [&robot, &world]() {
+    robot.LoadWorldFromString(world, /* enable graphics */ false);
+  });
+
+  robot.SaveWorldBinary(kBinaryWorldFilename);
+  Report("LoadWorld (binary world)", num_lines, [&robot]() {
+    robot.LoadWorld(kBinaryWorldFilename, /* enable graphics */ false);
+  });
+  remove(kWorldFilename);
+  remove(kBinaryWorldFilename);
+  return 0;
+}
@@ -0,0 +1,120 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+// Measures how Karel scales with the size of generated worlds: load time,
+// actions per second when headless and frames per second with graphics.
+// Run with an optional largest world size, for example
+// ./karel_scale_benchmark 300. Frames are only measured in worlds up to
+// 100x100, whose images fit on a screen, and are skipped without a display.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "../../../graphics/image.h"
+#include "../robot.h"
+#include "../world_generator.h"
+
+namespace {
+
+const char kWorldFilename[] = "scale_benchmark_world.w";
+const int kDefaultMaxSize = 1000;
+const int kSizes[] = {10, 30, 100, 300, 1000};
+const int kMaxGraphicsSize = 100;
+const uint64_t kSeed = 42;
+const int64_t kNumHeadlessActions = 1000000;
+const int64_t kNumGraphicsActions = 100;
+
+struct Layout {
+  const char* name;
+  karel::WorldLayout layout;
+};
+
+const Layout kLayouts[] = {{"maze", karel::WorldLayout::kMaze},
+                           {"beeper field", karel::WorldLayout::kBeeperField},
+                           {"spiral", karel::WorldLayout::kSpiral},
+                           {"rooms", karel::WorldLayout::kRooms}};
+
+double SecondsSince(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+// Returns true if images can be shown. Only tried once, as CImg may hang
+// when opening a display after failing to.
+bool HasDisplay() {
+  graphics::Image probe(1, 1);
+  return probe.ShowForMs(0, "Karel benchmark");
+}
+
+// Follows the wall on Karel's right, picking up any beepers, until Karel has
+// taken |num_actions| actions. Never ends in an error.
+void FollowWalls(karel::Robot* robot, int64_t num_actions) {
+  while (robot->GetNumActions() < num_actions) {
+    if (robot->BeepersPresent()) {
+      robot->PickBeeper();
+    } else if (robot->RightIsClear()) {
+      robot->TurnLeft();
+      robot->TurnLeft();
+      robot->TurnLeft();
+      robot->Move();
+    } else if (robot->FrontIsClear()) {
+      robot->Move();
+    } else {
+      robot->TurnLeft();
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int max_size = argc > 1 ? atoi(argv[1]) : kDefaultMaxSize;
+  bool has_display = HasDisplay();
+  karel::Robot robot;
+  for (const Layout& layout : kLayouts) {
+    for (int size : kSizes) {
+      if (size > max_size) break;
+      karel::GenerateWorldFile(kWorldFilename, layout.layout, size, size,
+                               kSeed);
+      std::string name = std::string(layout.name) + " " +
+                         std::to_string(size) + "x" + std::to_string(size);
+
+      auto start = std::chrono::steady_clock::now();
+      robot.LoadWorld(kWorldFilename, /* enable graphics */ false);
+      double load_seconds = SecondsSince(start);
+
+      start = std::chrono::steady_clock::now();
+      FollowWalls(&robot, kNumHeadlessActions);
+      double actions_per_second =
+          robot.GetNumActions() / SecondsSince(start);
+      std::cout << name << ": load " << load_seconds * 1000 << " ms, "
+                << static_cast<int64_t>(actions_per_second)
+                << " actions/sec headless";
+
+      if (size <= kMaxGraphicsSize && has_display) {
+        robot.LoadWorld(kWorldFilename, /* enable graphics */ true);
+        robot.SetSpeed(1e9);
+        int64_t frames_before = robot.GetStats().GetNumFrames();
+        start = std::chrono::steady_clock::now();
+        FollowWalls(&robot, kNumGraphicsActions);
+        double frames_per_second =
+            (robot.GetStats().GetNumFrames() - frames_before) /
+            SecondsSince(start);
+        std::cout << ", " << static_cast<int64_t>(frames_per_second)
+                  << " frames/sec";
+      }
+      std::cout << std::endl;
+    }
+  }
+  remove(kWorldFilename);
+  return 0;
+}
@@ -9,12 +9,28 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "../../../graphics/image.h"
+#include "../batch_runner.h"
+#include "../binary_world.h"
 #include "../cell.h"
 #include "../error.h"
 #include "../orientation.h"
 #include "../robot.h"
+#include "../stats.h"
+#include "../world.h"
+#include "../world_generator.h"
+#include "../trace.h"
 
+using karel::BatchResult;
 using karel::Cell;
 using karel::Orientation;
 using karel::Robot;
@@ -36,6 +52,32 @@ void CellIsEmptyWithNoWalls(const Cell& cell) {
   ASSERT_FALSE(cell.HasWestWall());
 }
 
+TEST(CellTest, StoresWallsAndBeepersIndependently) {
+  Cell cell;
+  CellIsEmptyWithNoWalls(cell);
+  cell.AddWall(Orientation::kEast);
+  cell.SetNumBeepers(100000);
+  EXPECT_EQ(100000, cell.GetNumBeepers());
+  EXPECT_FALSE(cell.HasNorthWall());
+  EXPECT_TRUE(cell.HasEastWall());
+  EXPECT_FALSE(cell.HasSouthWall());
+  EXPECT_FALSE(cell.HasWestWall());
+
+  cell.AddWall(Orientation::kWest);
+  cell.SetNumBeepers(0);
+  EXPECT_EQ(0, cell.GetNumBeepers());
+  EXPECT_TRUE(cell.HasEastWall());
+  EXPECT_TRUE(cell.HasWestWall());
+
+  // Counts are clamped.
+  cell.SetNumBeepers(-1);
+  EXPECT_EQ(0, cell.GetNumBeepers());
+  cell.SetNumBeepers(std::numeric_limits<int>::max());
+  EXPECT_EQ(Cell::kMaxBeepers, cell.GetNumBeepers());
+  EXPECT_TRUE(cell.HasEastWall());
+  EXPECT_TRUE(cell.HasWestWall());
+}
+
 TEST(KarelTest, GetsKarelInstance) {
   Robot& r = Robot::GetInstance(/* enable animations */ false,
                                 /* force initialize */ true);
@@ -223,6 +265,25 @@ TEST(KarelTest, CannotMoveThroughInnerWalls) {
   }
 }
 
+TEST(KarelTest, WallsBlockCellsOnBothSides) {
+  Robot& r = Robot::InitializeInstance("worlds/outer_walls.w",
+                                       /* enable animations */ false,
+                                       /* force initialize */ true);
+  // The north wall of (3, 5) also blocks (3, 6) to its north.
+  EXPECT_TRUE(r.GetCell(3, 5).IsBlocked(Orientation::kNorth));
+  EXPECT_TRUE(r.GetCell(3, 6).IsBlocked(Orientation::kSouth));
+  EXPECT_FALSE(r.GetCell(3, 6).HasSouthWall());
+  EXPECT_FALSE(r.GetCell(3, 5).IsBlocked(Orientation::kSouth));
+
+  // Edges of the world are blocked.
+  EXPECT_TRUE(r.GetCell(1, 1).IsBlocked(Orientation::kWest));
+  EXPECT_TRUE(r.GetCell(1, 1).IsBlocked(Orientation::kSouth));
+  EXPECT_FALSE(r.GetCell(1, 1).IsBlocked(Orientation::kNorth));
+  EXPECT_FALSE(r.GetCell(1, 1).IsBlocked(Orientation::kEast));
+  EXPECT_TRUE(r.GetCell(8, 8).IsBlocked(Orientation::kNorth));
+  EXPECT_TRUE(r.GetCell(8, 8).IsBlocked(Orientation::kEast));
+}
+
 TEST(KarelTest, CannotMoveThroughWorldEdges) {
   for (int i = 0; i < 4; i++) {
     Robot& r = Robot::InitializeInstance("worlds/2x1.w",
@@ -492,6 +553,733 @@ TEST(KarelTest, DoesNotTakeActionAfterErrorState) {
   EXPECT_EQ(0, r.GetNumBeepersInBag());
 }
 
+TEST(KarelTest, BindsIndependentRobotsToThreads) {
+  Robot& singleton = Robot::GetInstance(/* enable graphics */ false,
+                                        /* force initialize */ true);
+  const int kNumRobots = 4;
+  Robot robots[kNumRobots];
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumRobots; i++) {
+    threads.push_back(std::thread([&robots, i]() {
+      Robot::SetCurrentInstance(&robots[i]);
+      robots[i].LoadWorld("worlds/8x1.w", /* enable graphics */ false);
+      for (int j = 0; j <= i; j++) {
+        Move();
+      }
+      Robot::SetCurrentInstance(nullptr);
+    }));
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (int i = 0; i < kNumRobots; i++) {
+    EXPECT_EQ(i + 2, robots[i].GetXPosition());
+    EXPECT_EQ(RobotError::kNoError, robots[i].GetError());
+  }
+
+  // The singleton was not touched.
+  EXPECT_EQ(&singleton, &Robot::GetInstance());
+  EXPECT_EQ(10, singleton.GetWorldWidth());
+  EXPECT_EQ(1, singleton.GetXPosition());
+
+  // Binding on this thread redirects the Karel functions.
+  Robot::SetCurrentInstance(&robots[0]);
+  EXPECT_EQ(&robots[0], &Robot::GetInstance());
+  Move();
+  Robot::SetCurrentInstance(nullptr);
+  EXPECT_EQ(3, robots[0].GetXPosition());
+  EXPECT_EQ(1, singleton.GetXPosition());
+}
+
+TEST(KarelTest, RunsProgramInManyWorlds) {
+  std::vector<std::string> worlds = {"worlds/2x1.w", "worlds/8x1.w",
+                                     "worlds/does_not_exist.w",
+                                     "worlds/outer_walls.w", "worlds/1x8.w"};
+  auto program = []() {
+    while (FrontIsClear()) {
+      Move();
+    }
+    if (BeepersPresent()) {
+      PickBeeper();
+    }
+    Move();
+  };
+  // The robot passed to |on_finished| is still in its final state.
+  int num_finished = 0;
+  int num_mismatched = 0;
+  std::mutex mutex;
+  std::vector<BatchResult> results =
+      karel::RunBatch(program, worlds, /* num threads */ 3,
+                      [&](const Robot& robot, const BatchResult& result) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        num_finished++;
+                        if (robot.GetXPosition() != result.x ||
+                            robot.GetYPosition() != result.y ||
+                            robot.GetNumActions() != result.num_actions) {
+                          num_mismatched++;
+                        }
+                      });
+  ASSERT_EQ(worlds.size(), results.size());
+  EXPECT_EQ(4, num_finished);
+  EXPECT_EQ(0, num_mismatched);
+  for (size_t i = 0; i < worlds.size(); i++) {
+    EXPECT_EQ(worlds[i], results[i].filename);
+  }
+
+  EXPECT_EQ("", results[0].load_error);
+  EXPECT_EQ(2, results[0].x);
+  EXPECT_EQ(1, results[0].y);
+  EXPECT_EQ(Orientation::kEast, results[0].orientation);
+  EXPECT_EQ(RobotError::kCannotMoveEast, results[0].error);
+  EXPECT_EQ(2, results[0].num_actions);
+
+  EXPECT_EQ(8, results[1].x);
+  EXPECT_EQ(8, results[1].num_actions);
+
+  EXPECT_NE("", results[2].load_error);
+
+  // Walled in at the start.
+  EXPECT_EQ(3, results[3].x);
+  EXPECT_EQ(6, results[3].y);
+  EXPECT_EQ(3, results[3].beepers_in_bag);
+  EXPECT_EQ(1, results[3].num_actions);
+
+  EXPECT_EQ(1, results[4].x);
+  EXPECT_EQ(RobotError::kCannotMoveEast, results[4].error);
+  EXPECT_EQ("", results[4].program_error);
+}
+
+TEST(KarelTest, RecordsProgramExceptionsInBatch) {
+  std::vector<std::string> worlds = {"worlds/2x1.w", "worlds/8x1.w",
+                                     "worlds/1x8.w"};
+  // Throws in the 8x1 world only, after moving twice.
+  auto program = []() {
+    Move();
+    if (FrontIsClear()) {
+      Move();
+      throw std::runtime_error("out of ideas");
+    }
+  };
+  std::vector<BatchResult> results =
+      karel::RunBatch(program, worlds, /* num threads */ 2);
+  ASSERT_EQ(worlds.size(), results.size());
+  EXPECT_EQ("", results[0].program_error);
+  EXPECT_EQ(2, results[0].x);
+  EXPECT_EQ("Program threw an exception: out of ideas",
+            results[1].program_error);
+  EXPECT_EQ(3, results[1].x);
+  EXPECT_EQ(2, results[1].num_actions);
+  EXPECT_EQ("", results[2].program_error);
+}
+
+TEST(KarelTest, StopsWhenStepBudgetUsedUp) {
+  Robot robot;
+  Robot::SetCurrentInstance(&robot);
+  robot.LoadWorld("worlds/8x1.w", /* enable graphics */ false);
+  robot.SetStepBudget(100);
+  EXPECT_THROW(
+      while (true) {
+        if (FrontIsClear()) {
+          Move();
+        }
+        TurnLeft();
+      },
+      RobotError);
+  EXPECT_EQ(RobotError::kStepBudgetExceeded, robot.GetError());
+  EXPECT_EQ(101, robot.GetNumSteps());
+  Robot::SetCurrentInstance(nullptr);
+}
+
+TEST(KarelTest, DetectsInfiniteLoops) {
+  Robot robot;
+  Robot::SetCurrentInstance(&robot);
+  robot.LoadWorld("worlds/8x1.w", /* enable graphics */ false);
+  robot.SetLoopDetection(3);
+  // Spinning in place repeats the same four states.
+  EXPECT_THROW(
+      while (true) { TurnLeft(); }, RobotError);
+  EXPECT_EQ(RobotError::kInfiniteLoop, robot.GetError());
+  EXPECT_EQ(13, robot.GetNumActions());
+
+  // So does asking the same question forever.
+  robot.LoadWorld("worlds/8x1.w", /* enable graphics */ false);
+  robot.SetLoopDetection(10);
+  EXPECT_THROW(
+      while (!BeepersPresent()) {
+      },
+      RobotError);
+  EXPECT_EQ(RobotError::kInfiniteLoop, robot.GetError());
+
+  // A program that makes progress is left alone.
+  robot.LoadWorld("worlds/8x1.w", /* enable graphics */ false);
+  robot.SetLoopDetection(1);
+  while (FrontIsClear()) {
+    Move();
+  }
+  EXPECT_EQ(RobotError::kNoError, robot.GetError());
+
+  // Even when it asks several questions before each action.
+  robot.LoadWorld("worlds/8x1.w", /* enable graphics */ false);
+  robot.SetLoopDetection(1);
+  while (FrontIsClear() && !BeepersPresent() && FacingEast()) {
+    Move();
+  }
+  EXPECT_EQ(RobotError::kNoError, robot.GetError());
+  EXPECT_EQ(7, robot.GetNumActions());
+  Robot::SetCurrentInstance(nullptr);
+}
+
+TEST(KarelTest, HashesEqualStatesEqually) {
+  Robot first;
+  Robot second;
+  first.LoadWorld("worlds/8x1.w", /* enable graphics */ false);
+  second.LoadWorld("worlds/8x1.w", /* enable graphics */ false);
+  EXPECT_EQ(first.GetStateHash(), second.GetStateHash());
+
+  Robot::SetCurrentInstance(&first);
+  Move();
+  EXPECT_NE(first.GetStateHash(), second.GetStateHash());
+  TurnLeft();
+  TurnLeft();
+  Move();
+  TurnLeft();
+  TurnLeft();
+  EXPECT_EQ(first.GetStateHash(), second.GetStateHash());
+  PutBeeper();
+  uint64_t with_beeper = first.GetStateHash();
+  EXPECT_NE(with_beeper, second.GetStateHash());
+  PickBeeper();
+  EXPECT_EQ(first.GetStateHash(), second.GetStateHash());
+  Robot::SetCurrentInstance(nullptr);
+}
+
+TEST(KarelTest, SetsSpeed) {
+  Robot& r = Robot::InitializeInstance("worlds/2x1.w",
+                                       /* enable graphics */ false,
+                                       /* force initialize */ true);
+  EXPECT_DOUBLE_EQ(0.75, r.GetSpeed());
+  SetSpeed(4);
+  EXPECT_DOUBLE_EQ(4, r.GetSpeed());
+  SetSpeed(0);
+  EXPECT_DOUBLE_EQ(0.1, r.GetSpeed());
+}
+
+TEST(KarelTest, CopiesWorldsOnWrite) {
+  for (karel::WorldStorage storage :
+       {karel::WorldStorage::kDense, karel::WorldStorage::kSparse}) {
+    karel::World world;
+    world.Reset(100, 100, storage);
+    world.SetNumBeepers(5, 5, 1);
+    karel::World copy = world;
+    copy.SetNumBeepers(5, 5, 2);
+    copy.AddWall(99, 99, Orientation::kWest);
+    EXPECT_EQ(1, world.GetCell(5, 5).GetNumBeepers());
+    EXPECT_EQ(2, copy.GetCell(5, 5).GetNumBeepers());
+    EXPECT_FALSE(world.GetCell(98, 99).IsBlocked(Orientation::kEast));
+    EXPECT_TRUE(copy.GetCell(98, 99).IsBlocked(Orientation::kEast));
+    EXPECT_NE(world.GetHash(), copy.GetHash());
+    world.SetNumBeepers(6, 6, 3);
+    EXPECT_EQ(0, copy.GetCell(6, 6).GetNumBeepers());
+  }
+}
+
+TEST(KarelTest, RestoresSnapshots) {
+  Robot robot;
+  Robot::SetCurrentInstance(&robot);
+  robot.LoadWorld("worlds/beepers.w", /* enable graphics */ false);
+  Move();
+  karel::RobotSnapshot snapshot = robot.TakeSnapshot();
+  uint64_t hash = robot.GetStateHash();
+
+  // Explore one variant, ending in an error.
+  PickBeeper();
+  PickBeeper();
+  EXPECT_EQ(RobotError::kCannotPickBeeper, robot.GetError());
+
+  // And another from the same point.
+  robot.RestoreSnapshot(snapshot);
+  EXPECT_EQ(hash, robot.GetStateHash());
+  EXPECT_EQ(RobotError::kNoError, robot.GetError());
+  EXPECT_EQ(1, robot.GetCell(2, 1).GetNumBeepers());
+  EXPECT_EQ(1, robot.GetNumActions());
+  Move();
+  EXPECT_EQ(3, robot.GetXPosition());
+  EXPECT_EQ(2, robot.GetCell(3, 1).GetNumBeepers());
+
+  // Snapshots can be restored into another robot.
+  Robot other;
+  other.LoadWorld("", /* enable graphics */ false);
+  other.RestoreSnapshot(snapshot);
+  EXPECT_EQ(hash, other.GetStateHash());
+  EXPECT_EQ(robot.GetWorldWidth(), other.GetWorldWidth());
+  Robot::SetCurrentInstance(nullptr);
+}
+
+TEST(KarelTest, ComparesWorlds) {
+  Robot robot;
+  Robot::SetCurrentInstance(&robot);
+  robot.LoadWorld("worlds/beepers.w", /* enable graphics */ false);
+  EXPECT_TRUE(robot.WorldMatchesFile("worlds/beepers.w"));
+  karel::RobotSnapshot start = robot.TakeSnapshot();
+
+  Move();
+  PickBeeper();
+  Move();
+  PickBeeper();
+  std::vector<karel::CellDifference> differences;
+  EXPECT_FALSE(robot.WorldMatchesFile("worlds/beepers.w", 10, &differences));
+  ASSERT_EQ(2, differences.size());
+  EXPECT_EQ(2, differences[0].x);
+  EXPECT_EQ(1, differences[0].y);
+  EXPECT_EQ(0, differences[0].actual.GetNumBeepers());
+  EXPECT_EQ(1, differences[0].expected.GetNumBeepers());
+  EXPECT_EQ(3, differences[1].x);
+  EXPECT_EQ(1, differences[1].actual.GetNumBeepers());
+
+  // Only the first differences are reported.
+  differences.clear();
+  EXPECT_FALSE(robot.WorldMatches(start, 1, &differences));
+  EXPECT_EQ(1, differences.size());
+
+  // Karel's position does not matter.
+  PutBeeper();
+  TurnLeft();
+  TurnLeft();
+  Move();
+  PutBeeper();
+  EXPECT_TRUE(robot.WorldMatches(start));
+  Robot::SetCurrentInstance(nullptr);
+}
+
+TEST(KarelTest, ComparesLargeWorldsAcrossStorage) {
+  karel::World dense;
+  dense.Reset(500, 500, karel::WorldStorage::kDense);
+  karel::World sparse;
+  sparse.Reset(500, 500, karel::WorldStorage::kSparse);
+  EXPECT_TRUE(dense.Matches(sparse));
+
+  karel::World dense_copy = dense;
+  dense_copy.SetNumBeepers(1, 2, 1);
+  dense_copy.SetNumBeepers(499, 499, 1);
+  dense_copy.AddWall(250, 250, Orientation::kNorth);
+  karel::World sparse_copy = sparse;
+  sparse_copy.SetNumBeepers(499, 499, 1);
+  for (const karel::World* expected : {&sparse_copy, &dense_copy}) {
+    for (const karel::World* actual : {&dense, &sparse}) {
+      std::vector<karel::CellDifference> differences;
+      EXPECT_FALSE(actual->Matches(*expected, 10, &differences));
+      ASSERT_FALSE(differences.empty());
+      EXPECT_EQ(499, differences.back().x);
+      EXPECT_EQ(499, differences.back().y);
+      EXPECT_EQ(1, differences.back().expected.GetNumBeepers());
+    }
+  }
+  std::vector<karel::CellDifference> differences;
+  EXPECT_FALSE(dense.Matches(dense_copy, 10, &differences));
+  // The beepers and both cells blocked by the wall, in row-major order.
+  ASSERT_EQ(4, differences.size());
+  EXPECT_EQ(1, differences[0].x);
+  EXPECT_EQ(2, differences[0].y);
+  EXPECT_EQ(249, differences[1].y);
+  EXPECT_EQ(250, differences[2].y);
+
+  karel::World wider;
+  wider.Reset(501, 500);
+  EXPECT_FALSE(dense.Matches(wider, 10, &differences));
+}
+
+TEST(KarelTest, CountsActionsAndSensors) {
+  Robot robot;
+  Robot::SetCurrentInstance(&robot);
+  robot.LoadWorld("worlds/2x1.w", /* enable graphics */ false);
+  robot.EnableStatsOutput("karel_stats.json");
+  while (FrontIsClear()) {
+    Move();
+  }
+  PutBeeper();
+  TurnLeft();
+  TurnLeft();
+  Move();
+  Move();
+  EXPECT_FALSE(BeepersPresent());
+
+  const karel::RobotStats& stats = robot.GetStats();
+  EXPECT_EQ(3, stats.GetCount(karel::TraceOp::kMove));
+  EXPECT_EQ(2, stats.GetCount(karel::TraceOp::kTurnLeft));
+  EXPECT_EQ(1, stats.GetCount(karel::TraceOp::kPutBeeper));
+  EXPECT_EQ(0, stats.GetCount(karel::TraceOp::kPickBeeper));
+  EXPECT_EQ(2, stats.GetCount(karel::TraceOp::kFrontIsClear));
+  EXPECT_EQ(1, stats.GetCount(karel::TraceOp::kBeepersPresent));
+  // Visits are in world coordinates. The failed move does not count.
+  EXPECT_EQ(2, stats.GetNumVisits(0, 0));
+  EXPECT_EQ(1, stats.GetNumVisits(1, 0));
+
+  // The failed move finished Karel, writing the stats.
+  std::ifstream stream("karel_stats.json");
+  ASSERT_TRUE(stream.good());
+  std::string json;
+  std::getline(stream, json);
+  EXPECT_EQ(
+      "{\"actions\":{\"move\":3,\"turn_left\":2,\"put_beeper\":1,"
+      "\"pick_beeper\":0},\"sensors\":{\"has_beepers_in_bag\":0,"
+      "\"beepers_present\":0,\"front_is_clear\":2,\"left_is_clear\":0,"
+      "\"right_is_clear\":0,\"facing_north\":0,\"facing_east\":0,"
+      "\"facing_south\":0,\"facing_west\":0},\"frames\":0,\"width\":2,"
+      "\"height\":1,\"visits\":[[1,1,2],[2,1,1]]}",
+      json);
+  remove("karel_stats.json");
+
+  // Loading a world starts counting again, without visits until they are
+  // enabled.
+  robot.LoadWorld("worlds/2x1.w", /* enable graphics */ false);
+  EXPECT_EQ(0, robot.GetStats().GetCount(karel::TraceOp::kMove));
+  EXPECT_FALSE(robot.GetStats().CountsVisits());
+  Move();
+  EXPECT_EQ(1, robot.GetStats().GetCount(karel::TraceOp::kMove));
+  EXPECT_EQ(0, robot.GetStats().GetNumVisits(1, 0));
+  robot.EnableVisitCounts();
+  EXPECT_EQ(1, robot.GetStats().GetNumVisits(1, 0));
+  EXPECT_EQ(0, robot.GetStats().GetNumVisits(0, 0));
+  Robot::SetCurrentInstance(nullptr);
+}
+
+TEST(KarelTest, GeneratesWorlds) {
+  for (karel::WorldLayout layout :
+       {karel::WorldLayout::kEmpty, karel::WorldLayout::kMaze,
+        karel::WorldLayout::kBeeperField, karel::WorldLayout::kSpiral,
+        karel::WorldLayout::kRooms}) {
+    std::string world = karel::GenerateWorld(layout, 23, 17, /* seed */ 7);
+    EXPECT_EQ(world, karel::GenerateWorld(layout, 23, 17, /* seed */ 7));
+    Robot robot;
+    robot.LoadWorldFromString(world, /* enable graphics */ false);
+    EXPECT_EQ(23, robot.GetWorldWidth());
+    EXPECT_EQ(17, robot.GetWorldHeight());
+    EXPECT_EQ(1, robot.GetXPosition());
+    EXPECT_EQ(1, robot.GetYPosition());
+  }
+  EXPECT_NE(karel::GenerateWorld(karel::WorldLayout::kMaze, 10, 10, 1),
+            karel::GenerateWorld(karel::WorldLayout::kMaze, 10, 10, 2));
+  EXPECT_THROW(karel::GenerateWorld(karel::WorldLayout::kEmpty, 0, 5),
+               std::string);
+
+  // A maze has one fewer open wall than cells, and following the right wall
+  // through it, or through a spiral, finds the beeper.
+  std::string maze = karel::GenerateWorld(karel::WorldLayout::kMaze, 30, 20);
+  size_t num_walls = 0;
+  for (size_t i = maze.find("Wall:"); i != std::string::npos;
+       i = maze.find("Wall:", i + 1)) {
+    num_walls++;
+  }
+  EXPECT_EQ(29 * 20 + 30 * 19 - (30 * 20 - 1), num_walls);
+  for (karel::WorldLayout layout :
+       {karel::WorldLayout::kMaze, karel::WorldLayout::kSpiral}) {
+    Robot robot;
+    robot.LoadWorldFromString(karel::GenerateWorld(layout, 30, 20),
+                              /* enable graphics */ false);
+    robot.SetStepBudget(100000);
+    while (!robot.BeepersPresent()) {
+      if (robot.RightIsClear()) {
+        robot.TurnLeft();
+        robot.TurnLeft();
+        robot.TurnLeft();
+        robot.Move();
+      } else if (robot.FrontIsClear()) {
+        robot.Move();
+      } else {
+        robot.TurnLeft();
+      }
+    }
+    EXPECT_EQ(RobotError::kNoError, robot.GetError());
+  }
+}
+
+TEST(KarelTest, RecordsAndReplaysTrace) {
+  Robot robot;
+  Robot::SetCurrentInstance(&robot);
+  robot.LoadWorld("worlds/outer_walls.w", /* enable graphics */ false);
+  karel::Trace trace(/* capacity */ 1000);
+  robot.StartRecording(&trace);
+  while (FrontIsClear()) {
+    if (BeepersPresent()) {
+      PickBeeper();
+    }
+    Move();
+  }
+  TurnLeft();
+  PutBeeper();
+  Move();
+  robot.StopRecording();
+  Robot::SetCurrentInstance(nullptr);
+  ASSERT_EQ(robot.GetNumSteps(), trace.GetSize());
+  EXPECT_FALSE(trace.IsTruncated());
+  EXPECT_EQ(karel::TraceOp::kFrontIsClear, trace.GetOp(0));
+  EXPECT_EQ(karel::TraceOp::kMove, trace.GetOp(trace.GetSize() - 1));
+
+  // Replaying the whole trace reaches the same final state.
+  Robot replay;
+  replay.LoadWorld("worlds/outer_walls.w", /* enable graphics */ false);
+  EXPECT_TRUE(replay.ReplayTrace(trace, trace.GetSize()));
+  EXPECT_EQ(robot.GetStateHash(), replay.GetStateHash());
+  EXPECT_EQ(robot.GetError(), replay.GetError());
+
+  // Any prefix can be reconstructed, also from saved records.
+  karel::Trace saved(trace.GetData(), trace.GetSize());
+  replay.LoadWorld("worlds/outer_walls.w", /* enable graphics */ false);
+  EXPECT_TRUE(replay.ReplayTrace(saved, 3));
+  EXPECT_EQ(3, replay.GetNumSteps());
+
+  // Replaying in a different world is detected.
+  replay.LoadWorld("worlds/8x1.w", /* enable graphics */ false);
+  EXPECT_FALSE(replay.ReplayTrace(trace, trace.GetSize()));
+
+  // Full traces drop records instead of growing.
+  karel::Trace small(/* capacity */ 2);
+  small.Append(karel::TraceOp::kMove, true);
+  small.Append(karel::TraceOp::kFacingWest, false);
+  small.Append(karel::TraceOp::kTurnLeft, true);
+  EXPECT_EQ(2, small.GetSize());
+  EXPECT_TRUE(small.IsTruncated());
+  EXPECT_EQ(karel::TraceOp::kFacingWest, small.GetOp(1));
+  EXPECT_FALSE(small.GetResult(1));
+}
+
+TEST(KarelTest, LoadsWorldFromString) {
+  Robot from_file;
+  from_file.LoadWorld("worlds/beepers.w", /* enable graphics */ false);
+  std::ifstream file("worlds/beepers.w");
+  std::stringstream contents;
+  contents << file.rdbuf();
+  Robot from_string;
+  from_string.LoadWorldFromString(contents.str(), /* enable graphics */ false);
+  EXPECT_EQ(from_file.GetStateHash(), from_string.GetStateHash());
+
+  // Tokens may be split across lines and spaced freely.
+  from_string.LoadWorldFromString(
+      "Dimension: (3,\n2)\nWall: ( 2 , 1 )\twest Beeper: (3, 2) +12\n"
+      "BeeperBag: 7 Karel: (2, 2) North Speed: 2.5e-1\n",
+      /* enable graphics */ false);
+  EXPECT_EQ(3, from_string.GetWorldWidth());
+  EXPECT_EQ(2, from_string.GetWorldHeight());
+  EXPECT_TRUE(from_string.GetCell(2, 1).HasWestWall());
+  EXPECT_TRUE(from_string.GetCell(1, 1).IsBlocked(Orientation::kEast));
+  EXPECT_EQ(12, from_string.GetCell(3, 2).GetNumBeepers());
+  EXPECT_EQ(7, from_string.GetNumBeepersInBag());
+  EXPECT_EQ(2, from_string.GetXPosition());
+  EXPECT_EQ(Orientation::kNorth, from_string.GetOrientation());
+}
+
+// Returns the error thrown loading |contents|, or an empty string.
+std::string GetLoadError(const std::string& contents) {
+  Robot robot;
+  try {
+    robot.LoadWorldFromString(contents, /* enable graphics */ false);
+  } catch (std::string error) {
+    return error;
+  }
+  return "";
+}
+
+TEST(KarelTest, ReportsWorldFileErrors) {
+  EXPECT_EQ("Could not parse world dimensions from the first line (line 1)",
+            GetLoadError(""));
+  EXPECT_EQ("Could not parse world dimensions from the first line (line 1)",
+            GetLoadError("Dimension: (3, 99999999999)"));
+  EXPECT_EQ("Could not find \"Dimension:\" in first line (line 1)",
+            GetLoadError("Size: (3, 3)"));
+  EXPECT_EQ("Invalid syntax: expected a comma but found ; (line 1)",
+            GetLoadError("Dimension: (3; 3)"));
+  EXPECT_EQ("Unknown orientation up (line 3)",
+            GetLoadError("Dimension: (3, 3)\nBeeper: (1, 1) 2\n"
+                         "Wall: (1, 1) up\n"));
+  EXPECT_EQ("Error reading Beeper count (line 2)",
+            GetLoadError("Dimension: (3, 3)\nBeeper: (1, 1) many\n"));
+  EXPECT_EQ("A cell cannot hold more than 16777215 beepers (line 3)",
+            GetLoadError("Dimension: (3, 3)\nBeeper: (1, 1) 16777215\n"
+                         "Beeper: (2, 1) 20000000\n"));
+  EXPECT_EQ("Unknown BeeperBag quanity, lots (line 2)",
+            GetLoadError("Dimension: (3, 3)\nBeeperBag: lots\n"));
+  EXPECT_EQ("Error reading Speed (line 2)",
+            GetLoadError("Dimension: (3, 3)\nSpeed: fast\n"));
+  EXPECT_EQ("Unexpected token in file: Beepers: (line 2)",
+            GetLoadError("Dimension: (3, 3)\nBeepers: (1, 1) 1\n"));
+  EXPECT_EQ("Error opening file worlds/does_not_exist.w",
+            [] {
+              try {
+                Robot().LoadWorld("worlds/does_not_exist.w", false);
+              } catch (std::string error) {
+                return error;
+              }
+              return std::string();
+            }());
+}
+
+TEST(KarelTest, CannotPutBeeperOnFullCell) {
+  Robot robot;
+  robot.LoadWorldFromString(
+      "Dimension: (2, 1)\nBeeper: (1, 1) 16777214\nBeeperBag: 2\n"
+      "Karel: (1, 1) East\n",
+      /* enable graphics */ false);
+  robot.PutBeeper();
+  EXPECT_EQ(RobotError::kNoError, robot.GetError());
+  EXPECT_EQ(Cell::kMaxBeepers, robot.GetCell(1, 1).GetNumBeepers());
+
+  // The beeper stays in the bag rather than disappearing.
+  robot.PutBeeper();
+  EXPECT_EQ(RobotError::kCannotPutBeeper, robot.GetError());
+  EXPECT_EQ(Cell::kMaxBeepers, robot.GetCell(1, 1).GetNumBeepers());
+  EXPECT_EQ(1, robot.GetNumBeepersInBag());
+}
+
+TEST(KarelTest, SavesAndLoadsBinaryWorlds) {
+  const std::string kBinaryFilename = "test_world.kw";
+  karel::ConvertToBinaryWorld("worlds/inner_walls.w", kBinaryFilename);
+  Robot text;
+  text.LoadWorld("worlds/inner_walls.w", /* enable graphics */ false);
+  Robot binary;
+  binary.LoadWorld(kBinaryFilename, /* enable graphics */ false);
+  EXPECT_EQ(text.GetStateHash(), binary.GetStateHash());
+  EXPECT_EQ(text.GetWorldWidth(), binary.GetWorldWidth());
+  EXPECT_EQ(text.GetWorldHeight(), binary.GetWorldHeight());
+  EXPECT_EQ(text.GetXPosition(), binary.GetXPosition());
+  EXPECT_EQ(text.GetYPosition(), binary.GetYPosition());
+  EXPECT_EQ(text.GetOrientation(), binary.GetOrientation());
+  EXPECT_EQ(42, binary.GetNumBeepersInBag());
+  EXPECT_TRUE(binary.GetCell(3, 2).HasNorthWall());
+  EXPECT_TRUE(binary.GetCell(3, 2).HasWestWall());
+
+  // The current state is saved, not the file it was loaded from.
+  Robot::SetCurrentInstance(&binary);
+  PutBeeper();
+  PutBeeper();
+  Robot::SetCurrentInstance(nullptr);
+  binary.SaveWorldBinary(kBinaryFilename);
+  Robot reloaded;
+  reloaded.LoadWorld(kBinaryFilename, /* enable graphics */ false);
+  EXPECT_EQ(binary.GetStateHash(), reloaded.GetStateHash());
+  EXPECT_EQ(2, reloaded.GetCell(3, 2).GetNumBeepers());
+  EXPECT_EQ(40, reloaded.GetNumBeepersInBag());
+
+  // Truncated files are rejected.
+  std::stringstream data;
+  data << std::ifstream(kBinaryFilename, std::ios::binary).rdbuf();
+  std::ofstream(kBinaryFilename, std::ios::binary)
+      << data.str().substr(0, data.str().size() - 1);
+  EXPECT_THROW(reloaded.LoadWorld(kBinaryFilename, false), std::string);
+  std::remove(kBinaryFilename.c_str());
+}
+
+// Returns the error decoding a 2x1 binary world with |header|, or an empty
+// string.
+std::string GetBinaryDecodeError(const karel::BinaryWorldHeader& header) {
+  karel::World world;
+  world.Reset(2, 1);
+  std::string data = karel::EncodeBinaryWorld(world, header);
+  std::string error;
+  karel::World decoded;
+  karel::BinaryWorldHeader decoded_header;
+  karel::DecodeBinaryWorld(data.data(), data.size(), karel::WorldStorage::kDense,
+                           &decoded, &decoded_header, &error);
+  return error;
+}
+
+TEST(KarelTest, ValidatesBinaryWorldHeaders) {
+  karel::BinaryWorldHeader header;
+  header.karel = {0, 0, Orientation::kEast};
+  EXPECT_EQ("", GetBinaryDecodeError(header));
+
+  karel::BinaryWorldHeader bad_bag = header;
+  bad_bag.beepers_in_bag = -2;
+  EXPECT_EQ("Binary world beeper bag count -2 is invalid",
+            GetBinaryDecodeError(bad_bag));
+
+  for (double speed : {-1.0, std::numeric_limits<double>::quiet_NaN(),
+                       std::numeric_limits<double>::infinity()}) {
+    karel::BinaryWorldHeader bad_speed = header;
+    bad_speed.speed = speed;
+    EXPECT_EQ("Binary world speed must be a number greater than 0",
+              GetBinaryDecodeError(bad_speed))
+        << speed;
+  }
+
+  // Counts which a cell cannot hold are rejected, as in text worlds. The
+  // world ends with a run of 2 empty cells: replace its count with the
+  // varint for 2^24.
+  karel::World world;
+  world.Reset(2, 1);
+  std::string data = karel::EncodeBinaryWorld(world, header);
+  ASSERT_EQ('\0', data.back());
+  data.pop_back();
+  data += "\x80\x80\x80\x08";
+  std::string error;
+  karel::BinaryWorldHeader decoded_header;
+  EXPECT_FALSE(karel::DecodeBinaryWorld(data.data(), data.size(),
+                                        karel::WorldStorage::kDense, &world,
+                                        &decoded_header, &error));
+  EXPECT_EQ("Too many beepers in binary world", error);
+
+  // Slow speeds are raised to the minimum, as in text worlds.
+  const std::string kBinaryFilename = "test_slow_world.kw";
+  karel::BinaryWorldHeader slow = header;
+  slow.speed = 0;
+  std::ofstream(kBinaryFilename, std::ios::binary)
+      << karel::EncodeBinaryWorld(world, slow);
+  Robot robot;
+  robot.LoadWorld(kBinaryFilename, /* enable graphics */ false);
+  EXPECT_DOUBLE_EQ(0.1, robot.GetSpeed());
+  std::remove(kBinaryFilename.c_str());
+}
+
+TEST(KarelTest, StoresWorldsSparsely) {
+  for (std::string filename :
+       {"worlds/2x1.w", "worlds/8x1.w", "worlds/1x8.w", "worlds/beepers.w",
+        "worlds/inner_walls.w", "worlds/outer_walls.w"}) {
+    Robot dense;
+    dense.LoadWorld(filename, /* enable graphics */ false);
+    Robot sparse;
+    sparse.SetWorldStorage(karel::WorldStorage::kSparse);
+    sparse.LoadWorld(filename, /* enable graphics */ false);
+    EXPECT_EQ(dense.GetStateHash(), sparse.GetStateHash()) << filename;
+    for (int x = 1; x <= dense.GetWorldWidth(); x++) {
+      for (int y = 1; y <= dense.GetWorldHeight(); y++) {
+        EXPECT_TRUE(dense.GetCell(x, y) == sparse.GetCell(x, y))
+            << filename << " (" << x << ", " << y << ")";
+      }
+    }
+  }
+
+  // Only cells with walls or beepers, and their neighbors across walls, take
+  // memory.
+  karel::World world;
+  world.Reset(100000, 100000, karel::WorldStorage::kSparse);
+  EXPECT_EQ(0, world.GetNumStoredCells());
+  world.AddWall(500, 500, Orientation::kNorth);
+  world.SetNumBeepers(99999, 99999, 3);
+  EXPECT_EQ(3, world.GetNumStoredCells());
+  EXPECT_TRUE(world.GetCell(500, 499).IsBlocked(Orientation::kSouth));
+  EXPECT_TRUE(world.GetCell(99999, 99999).IsBlocked(Orientation::kEast));
+  EXPECT_TRUE(world.GetCell(0, 5).IsBlocked(Orientation::kWest));
+  EXPECT_FALSE(world.GetCell(1, 5).IsBlocked(Orientation::kWest));
+  world.SetNumBeepers(99999, 99999, 0);
+  EXPECT_EQ(2, world.GetNumStoredCells());
+
+  // Karel works as usual in a huge sparse world.
+  Robot robot;
+  robot.SetWorldStorage(karel::WorldStorage::kSparse);
+  Robot::SetCurrentInstance(&robot);
+  robot.LoadWorldFromString(
+      "Dimension: (100000, 100000)\nWall: (3, 1) east\nBeeper: (2, 1) 5\n"
+      "Karel: (1, 1) East\n",
+      /* enable graphics */ false);
+  Move();
+  EXPECT_TRUE(BeepersPresent());
+  PickBeeper();
+  Move();
+  EXPECT_FALSE(FrontIsClear());
+  EXPECT_TRUE(RightIsBlocked());
+  EXPECT_EQ(4, robot.GetCell(2, 1).GetNumBeepers());
+  Robot::SetCurrentInstance(nullptr);
+}
+
 TEST(KarelTest, SavesWorldBmp) {
   Robot& r = Robot::GetInstance(/* enable graphics */ false,
                                 /* force initialize */ true);
@@ -506,6 +1294,24 @@ TEST(KarelTest, SavesWorldBmp) {
   remove(name.c_str());
 }
 
+TEST(KarelTest, SavesHeadlessWorldBmpWithCurrentState) {
+  Robot& r = Robot::InitializeInstance("worlds/2x1.w",
+                                       /* enable graphics */ false,
+                                       /* force initialize */ true);
+  Move();
+  std::string name = "test_headless_world.bmp";
+  r.SaveWorldBmp(name);
+  graphics::Image image;
+  ASSERT_TRUE(image.Load(name));
+  remove(name.c_str());
+
+  // Karel's body is drawn in the second cell and the first cell is empty.
+  const graphics::Color karel_color(125, 125, 125);
+  const graphics::Color white(255, 255, 255);
+  EXPECT_EQ(karel_color, image.GetColor(50 + 13, 13));
+  EXPECT_EQ(white, image.GetColor(13, 13));
+}
+
 TEST(KarelTest, PromptsBetweenActionsWhenSet) {
   std::streambuf* original = std::cin.rdbuf();
   std::istringstream stream("c\nc\n");
@@ -598,6 +1404,46 @@ TEST(KarelTest, GeneratesCSVOutput) {
   remove("karel.csv");
 }
 
+TEST(KarelTest, AppendsIncrementalCSVOutput) {
+  for (bool use_background_thread : {false, true}) {
+    Robot robot;
+    Robot::SetCurrentInstance(&robot);
+    robot.LoadWorld("worlds/2x1.w", /* enable graphics */ false);
+    robot.EnableIncrementalCSVOutput(/* snapshot interval */ 3,
+                                     use_background_thread);
+    Move();
+    PutBeeper();
+    TurnLeft();
+    Move();
+    Robot::SetCurrentInstance(nullptr);
+    robot.Finish();
+
+    std::ifstream stream("karel_log.csv");
+    std::string line;
+    std::vector<std::string> lines;
+    while (std::getline(stream, line)) {
+      lines.push_back(line);
+    }
+    std::vector<std::string> expected = {
+        "symbol,kn,ke,ks,kw,o,b,w,\"(x,y)\"",
+        "meaning,Karel facing north,Karel facing east, Karel facing south, "
+        "Karel facing west,empty cell,cell with beepers and count,wall "
+        "between cells,cell coordinates",
+        // The whole world when the log starts.
+        "snapshot,0", "\"ke o (1,1)\",,\"o (2,1)\",", "", "",
+        // Only the changed cells after each action.
+        "step,1", "\"o (1,1)\"", "\"ke o (2,1)\"",
+        "step,2", "\"ke b1 (2,1)\"",
+        // A periodic snapshot.
+        "snapshot,3", "\"o (1,1)\",,\"kn b1 (2,1)\",", "", "",
+        // Moving north is an error, which finishes with a snapshot.
+        "snapshot,4", "\"o (1,1)\",,\"kn b1 (2,1)\",", "",
+        "Error:  Cannot move north"};
+    EXPECT_EQ(expected, lines) << use_background_thread;
+    remove("karel_log.csv");
+  }
+}
+
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -0,0 +1,26 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "trace.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace karel {
+
+Trace::Trace(size_t capacity) : capacity_(capacity) {
+  records_.reserve(capacity);
+}
+
+Trace::Trace(const uint8_t* records, size_t size)
+    : records_(records, records + size), capacity_(size) {}
+
+void Trace::Clear() {
+  records_.clear();
+  truncated_ = false;
+}
+
+}  // namespace karel
@@ -0,0 +1,110 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#ifndef TRACE_H
+#define TRACE_H
+
+namespace karel {
+
+/**
+ * The actions and sensor queries which can be recorded in a Trace.
+ */
+enum class TraceOp : uint8_t {
+  kMove = 0,
+  kTurnLeft,
+  kPutBeeper,
+  kPickBeeper,
+  kHasBeepersInBag,
+  kBeepersPresent,
+  kFrontIsClear,
+  kLeftIsClear,
+  kRightIsClear,
+  kFacingNorth,
+  kFacingEast,
+  kFacingSouth,
+  kFacingWest,
+};
+
+// The number of TraceOp values.
+constexpr int kNumTraceOps = static_cast<int>(TraceOp::kFacingWest) + 1;
+
+/**
+ * A compact record of everything a Karel program did, one byte per action or
+ * sensor query. The low four bits of each record hold the TraceOp and bit
+ * four holds the result: whether the action succeeded, or the value the
+ * sensor returned.
+ *
+ * Storage is allocated once up front. Records past the capacity are dropped
+ * and the trace is marked truncated, so recording never allocates while a
+ * program runs.
+ */
+class Trace {
+ public:
+  /**
+   * Creates an empty trace which can hold up to |capacity| records.
+   */
+  explicit Trace(size_t capacity);
+
+  /**
+   * Creates a trace holding |size| records previously read from GetData.
+   */
+  Trace(const uint8_t* records, size_t size);
+
+  /**
+   * Adds a record, or marks the trace truncated if it is full.
+   */
+  void Append(TraceOp op, bool result) {
+    if (records_.size() == capacity_) {
+      truncated_ = true;
+      return;
+    }
+    records_.push_back(static_cast<uint8_t>(op) |
+                       (result ? kResultBit : 0));
+  }
+
+  /**
+   * Removes all records, keeping the capacity.
+   */
+  void Clear();
+
+  size_t GetSize() const { return records_.size(); }
+  size_t GetCapacity() const { return capacity_; }
+
+  /**
+   * Returns true if records were dropped because the trace was full.
+   */
+  bool IsTruncated() const { return truncated_; }
+
+  TraceOp GetOp(size_t index) const {
+    return static_cast<TraceOp>(records_[index] & kOpMask);
+  }
+
+  bool GetResult(size_t index) const {
+    return (records_[index] & kResultBit) != 0;
+  }
+
+  /**
+   * Gets the raw records, GetSize() bytes long, for example to save them.
+   */
+  const uint8_t* GetData() const { return records_.data(); }
+
+ private:
+  static constexpr uint8_t kOpMask = 0x0f;
+  static constexpr uint8_t kResultBit = 0x10;
+
+  std::vector<uint8_t> records_;
+  size_t capacity_;
+  bool truncated_ = false;
+};
+
+}  // namespace karel
+
+#endif  // TRACE_H
@@ -0,0 +1,216 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "world.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "cell.h"
+#include "orientation.h"
+
+namespace karel {
+
+namespace {
+
+// Dense chunks are compared with memcmp.
+static_assert(std::is_trivially_copyable<Cell>::value &&
+                  sizeof(Cell) == sizeof(uint32_t),
+              "Cells must be comparable as raw memory");
+
+// Empty cells for each combination of blocked directions, indexed by a mask
+// with bit n set when Orientation n is blocked.
+struct EmptyCells {
+  EmptyCells() {
+    for (int mask = 0; mask < 16; mask++) {
+      for (int o = Orientation::kNorth; o <= Orientation::kWest; o++) {
+        if (mask & (1 << o)) cells[mask].Block(static_cast<Orientation>(o));
+      }
+    }
+  }
+  Cell cells[16];
+};
+
+const EmptyCells kEmptyCells;
+
+}  // namespace
+
+void World::Reset(int width, int height, WorldStorage storage) {
+  width_ = width;
+  height_ = height;
+  storage_ = storage;
+  hash_ = HashMix(static_cast<uint64_t>(width) << 32 | height);
+  // Never clear storage in place, it may be shared with a copy.
+  chunks_.clear();
+  sparse_cells_ = std::make_shared<std::unordered_map<size_t, Cell>>();
+  if (storage == WorldStorage::kSparse) return;
+  size_t num_cells = static_cast<size_t>(width) * height;
+  chunks_.resize((num_cells + kChunkSize - 1) >> kChunkBits);
+  for (size_t chunk = 0; chunk < chunks_.size(); chunk++) {
+    chunks_[chunk].reset(new Cell[GetChunkSize(chunk)]);
+  }
+  for (int x = 0; x < width; x++) {
+    GetMutableCell(x, 0).Block(Orientation::kNorth);
+    GetMutableCell(x, height - 1).Block(Orientation::kSouth);
+  }
+  for (int y = 0; y < height; y++) {
+    GetMutableCell(0, y).Block(Orientation::kWest);
+    GetMutableCell(width - 1, y).Block(Orientation::kEast);
+  }
+}
+
+void World::AddWall(int x, int y, Orientation wall_orientation) {
+  size_t index = Index(x, y);
+  Cell& cell = GetMutableCell(x, y);
+  if (cell.HasWall(wall_orientation)) return;
+  cell.AddWall(wall_orientation);
+  hash_ ^= WallKey(index, wall_orientation);
+  cell.Block(wall_orientation);
+  // Block the neighbor in the opposite direction, unless the wall is on the
+  // edge of the world.
+  switch (wall_orientation) {
+    case Orientation::kNorth:
+      if (y > 0) GetMutableCell(x, y - 1).Block(Orientation::kSouth);
+      break;
+    case Orientation::kEast:
+      if (x < width_ - 1) GetMutableCell(x + 1, y).Block(Orientation::kWest);
+      break;
+    case Orientation::kSouth:
+      if (y < height_ - 1) {
+        GetMutableCell(x, y + 1).Block(Orientation::kNorth);
+      }
+      break;
+    case Orientation::kWest:
+      if (x > 0) GetMutableCell(x - 1, y).Block(Orientation::kEast);
+      break;
+  }
+}
+
+const Cell& World::GetEmptyCell(int x, int y) const {
+  int blocked = 0;
+  if (y == 0) blocked |= 1 << Orientation::kNorth;
+  if (x == width_ - 1) blocked |= 1 << Orientation::kEast;
+  if (y == height_ - 1) blocked |= 1 << Orientation::kSouth;
+  if (x == 0) blocked |= 1 << Orientation::kWest;
+  return kEmptyCells.cells[blocked];
+}
+
+const Cell& World::GetSparseCell(int x, int y) const {
+  auto it = sparse_cells_->find(Index(x, y));
+  if (it == sparse_cells_->end()) return GetEmptyCell(x, y);
+  return it->second;
+}
+
+void World::RemoveIfEmpty(int x, int y) {
+  // Only called after GetMutableCell, so the map is not shared.
+  auto it = sparse_cells_->find(Index(x, y));
+  if (it != sparse_cells_->end() && it->second == GetEmptyCell(x, y)) {
+    sparse_cells_->erase(it);
+  }
+}
+
+Cell& World::GetMutableCell(int x, int y) {
+  size_t index = Index(x, y);
+  if (storage_ == WorldStorage::kDense) {
+    std::shared_ptr<Cell[]>& chunk = chunks_[index >> kChunkBits];
+    if (chunk.use_count() > 1) {
+      size_t size = GetChunkSize(index >> kChunkBits);
+      std::shared_ptr<Cell[]> copy(new Cell[size]);
+      std::copy(chunk.get(), chunk.get() + size, copy.get());
+      chunk = std::move(copy);
+    }
+    return chunk[index & kChunkMask];
+  }
+  if (sparse_cells_.use_count() > 1) {
+    sparse_cells_ =
+        std::make_shared<std::unordered_map<size_t, Cell>>(*sparse_cells_);
+  }
+  return sparse_cells_->emplace(index, GetEmptyCell(x, y)).first->second;
+}
+
+bool World::Matches(const World& expected, size_t max_differences,
+                    std::vector<CellDifference>* differences) const {
+  if (width_ != expected.width_ || height_ != expected.height_) return false;
+  if (hash_ == expected.hash_) return true;
+  if (differences == nullptr || max_differences == 0) return false;
+
+  size_t limit = differences->size() + max_differences;
+  if (storage_ == WorldStorage::kDense &&
+      expected.storage_ == WorldStorage::kDense) {
+    for (size_t chunk = 0; chunk < chunks_.size(); chunk++) {
+      const Cell* cells = chunks_[chunk].get();
+      const Cell* expected_cells = expected.chunks_[chunk].get();
+      // Chunks shared by copy-on-write are equal without looking.
+      if (cells == expected_cells) continue;
+      size_t size = GetChunkSize(chunk);
+      if (memcmp(cells, expected_cells, size * sizeof(Cell)) == 0) continue;
+      AppendDifferences(cells, expected_cells, chunk << kChunkBits, size,
+                        limit, differences);
+      if (differences->size() >= limit) break;
+    }
+  } else if (storage_ == WorldStorage::kSparse &&
+             expected.storage_ == WorldStorage::kSparse) {
+    // Only cells stored by either world can differ.
+    std::vector<size_t> indexes;
+    indexes.reserve(sparse_cells_->size() + expected.sparse_cells_->size());
+    for (const auto& entry : *sparse_cells_) indexes.push_back(entry.first);
+    for (const auto& entry : *expected.sparse_cells_) {
+      indexes.push_back(entry.first);
+    }
+    std::sort(indexes.begin(), indexes.end());
+    indexes.erase(std::unique(indexes.begin(), indexes.end()), indexes.end());
+    for (size_t index : indexes) {
+      int x = static_cast<int>(index % width_);
+      int y = static_cast<int>(index / width_);
+      Cell cell = GetCell(x, y);
+      Cell expected_cell = expected.GetCell(x, y);
+      if (cell != expected_cell) {
+        differences->push_back({x, y, cell, expected_cell});
+        if (differences->size() >= limit) break;
+      }
+    }
+  } else {
+    for (int y = 0; y < height_ && differences->size() < limit; y++) {
+      for (int x = 0; x < width_ && differences->size() < limit; x++) {
+        Cell cell = GetCell(x, y);
+        Cell expected_cell = expected.GetCell(x, y);
+        if (cell != expected_cell) {
+          differences->push_back({x, y, cell, expected_cell});
+        }
+      }
+    }
+  }
+  return false;
+}
+
+void World::AppendDifferences(const Cell* cells, const Cell* expected_cells,
+                              size_t index, size_t count, size_t limit,
+                              std::vector<CellDifference>* differences) const {
+  const Cell* end = cells + count;
+  auto mismatch = std::mismatch(cells, end, expected_cells);
+  while (mismatch.first != end && differences->size() < limit) {
+    size_t cell_index = index + (mismatch.first - cells);
+    differences->push_back({static_cast<int>(cell_index % width_),
+                            static_cast<int>(cell_index / width_),
+                            *mismatch.first, *mismatch.second});
+    mismatch = std::mismatch(mismatch.first + 1, end, mismatch.second + 1);
+  }
+}
+
+size_t World::GetChunkSize(size_t chunk) const {
+  size_t num_cells = static_cast<size_t>(width_) * height_;
+  return std::min(kChunkSize, num_cells - (chunk << kChunkBits));
+}
+
+}  // namespace karel
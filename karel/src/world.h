@@ -0,0 +1,192 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "cell.h"
+#include "orientation.h"
+
+#ifndef WORLD_H
+#define WORLD_H
+
+namespace karel {
+
+/**
+ * Mixes the bits of |value| into a well-distributed 64-bit hash (the
+ * SplitMix64 finalizer). Used to derive Zobrist keys for world state without
+ * storing key tables.
+ */
+inline uint64_t HashMix(uint64_t value) {
+  value += 0x9e3779b97f4a7c15ULL;
+  value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+  return value ^ (value >> 31);
+}
+
+/**
+ * How a World stores its cells.
+ */
+enum class WorldStorage {
+  // Every cell, in fixed-size chunks. Fastest for normal worlds.
+  kDense,
+  // A hash map holding only the cells with walls, beepers or a wall next to
+  // them. Empty cells take no memory, for huge, mostly empty worlds.
+  kSparse,
+};
+
+/**
+ * A cell which differs between two worlds, see World::Matches.
+ */
+struct CellDifference {
+  int x = 0;
+  int y = 0;
+  Cell actual;
+  Cell expected;
+};
+
+/**
+ * The grid of cells in Karel's world. Cells are stored in row-major order,
+ * either all in contiguous chunks or sparsely (see WorldStorage).
+ * Coordinates are world coordinates, where (0, 0) is the top left cell.
+ *
+ * Each cell knows which directions Karel cannot move from it, including the
+ * world's edges, so checking for a wall is a single lookup.
+ *
+ * The world keeps a Zobrist-style hash of its walls and beepers which is
+ * updated on every change, so comparing states is O(1) up to the chance of
+ * a hash collision.
+ *
+ * Copying a world is cheap: copies share storage until one of them changes
+ * it. A dense world then copies only the chunk being changed, and a sparse
+ * world copies its map of cells. This makes copies good snapshots for
+ * backtracking and undo. Copies may be used on different threads.
+ */
+class World {
+ public:
+  /**
+   * Resizes the world to |width| by |height| empty cells with no walls.
+   */
+  void Reset(int width, int height,
+             WorldStorage storage = WorldStorage::kDense);
+
+  int GetWidth() const { return width_; }
+  int GetHeight() const { return height_; }
+
+  WorldStorage GetStorage() const { return storage_; }
+
+  /**
+   * Returns the cell at (x, y). Cells are returned by value: a reference
+   * would be invalidated when a sparse world removes an emptied cell or a
+   * dense world copies a shared chunk on write.
+   */
+  Cell GetCell(int x, int y) const {
+    if (storage_ == WorldStorage::kDense) {
+      size_t index = Index(x, y);
+      return chunks_[index >> kChunkBits][index & kChunkMask];
+    }
+    return GetSparseCell(x, y);
+  }
+
+  void SetNumBeepers(int x, int y, int beepers) {
+    size_t index = Index(x, y);
+    Cell& cell = GetMutableCell(x, y);
+    hash_ ^= BeeperKey(index, cell.GetNumBeepers());
+    cell.SetNumBeepers(beepers);
+    hash_ ^= BeeperKey(index, cell.GetNumBeepers());
+    if (storage_ == WorldStorage::kSparse) RemoveIfEmpty(x, y);
+  }
+
+  /**
+   * Adds a wall on the given side of the cell at (x, y). Both the cell and
+   * its neighbor across the wall become blocked in that direction.
+   */
+  void AddWall(int x, int y, Orientation wall_orientation);
+
+  /**
+   * Returns a hash of the world's size, walls and beepers.
+   */
+  uint64_t GetHash() const { return hash_; }
+
+  /**
+   * Returns true if this world has the same size, walls and beepers as
+   * |expected|. Worlds with equal hashes are taken to match without looking
+   * at their cells, so this is O(1) when they match or when |differences| is
+   * null. The result is therefore probabilistic: two different worlds whose
+   * 64-bit Zobrist hashes collide are reported as matching, which happens
+   * with probability about 2^-64 per comparison. Otherwise up to
+   * |max_differences| differing cells are appended to |differences| in
+   * row-major order. Dense worlds are compared a chunk at a time, skipping
+   * chunks they share. Worlds of different sizes report no cells.
+   */
+  bool Matches(const World& expected, size_t max_differences = 0,
+               std::vector<CellDifference>* differences = nullptr) const;
+
+  /**
+   * Returns the number of cells held in memory.
+   */
+  size_t GetNumStoredCells() const {
+    return storage_ == WorldStorage::kDense
+               ? static_cast<size_t>(width_) * height_
+               : sparse_cells_->size();
+  }
+
+ private:
+  // Dense worlds are stored in chunks of 2^kChunkBits cells, 16 KiB.
+  static constexpr int kChunkBits = 12;
+  static constexpr size_t kChunkSize = size_t{1} << kChunkBits;
+  static constexpr size_t kChunkMask = kChunkSize - 1;
+
+  size_t Index(int x, int y) const {
+    return static_cast<size_t>(y) * width_ + x;
+  }
+
+  // Sparse storage: an empty cell blocked only by the world's edges.
+  const Cell& GetEmptyCell(int x, int y) const;
+  const Cell& GetSparseCell(int x, int y) const;
+  void RemoveIfEmpty(int x, int y);
+
+  // Gets a cell to modify, first copying any storage shared with another
+  // world and adding the cell to sparse storage if needed.
+  Cell& GetMutableCell(int x, int y);
+
+  // Number of cells in the dense chunk at |chunk|.
+  size_t GetChunkSize(size_t chunk) const;
+
+  // Appends the cells where |count| cells from |cells| and |expected_cells|,
+  // starting at |index|, differ until |differences| holds |limit| cells.
+  void AppendDifferences(const Cell* cells, const Cell* expected_cells,
+                         size_t index, size_t count, size_t limit,
+                         std::vector<CellDifference>* differences) const;
+
+  // Zobrist key for |beepers| in the cell at |index|. Empty cells have no key
+  // so they do not need to be hashed when the world is reset.
+  static uint64_t BeeperKey(size_t index, int beepers) {
+    if (beepers == 0) return 0;
+    return HashMix(HashMix(index << 1) ^ beepers);
+  }
+
+  // Zobrist key for a wall on the |wall_orientation| side of a cell.
+  static uint64_t WallKey(size_t index, Orientation wall_orientation) {
+    return HashMix(((index << 2 | wall_orientation) << 1) | 1);
+  }
+
+  int width_ = 0;
+  int height_ = 0;
+  WorldStorage storage_ = WorldStorage::kDense;
+  std::vector<std::shared_ptr<Cell[]>> chunks_;
+  std::shared_ptr<std::unordered_map<size_t, Cell>> sparse_cells_ =
+      std::make_shared<std::unordered_map<size_t, Cell>>();
+  uint64_t hash_ = 0;
+};
+
+}  // namespace karel
+
+#endif  // WORLD_H
@@ -0,0 +1,210 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "world_generator.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "world.h"
+
+namespace karel {
+
+namespace {
+
+// Width and height of each room in WorldLayout::kRooms.
+const int kRoomSize = 5;
+
+// A small random number generator (SplitMix64) which, unlike the standard
+// library distributions, gives the same numbers on every platform.
+class Random {
+ public:
+  explicit Random(uint64_t seed) : state_(seed) {}
+
+  // Returns a number in [0, n).
+  int Uniform(int n) { return static_cast<int>(HashMix(state_++) % n); }
+
+ private:
+  uint64_t state_;
+};
+
+// Helpers to append world file lines. Positions are in grid coordinates,
+// where (1, 1) is the bottom left cell.
+void AppendWall(int x, int y, const char* direction, std::string* world) {
+  *world += "Wall: (" + std::to_string(x) + ", " + std::to_string(y) + ") " +
+            direction + "\n";
+}
+
+void AppendBeeper(int x, int y, int count, std::string* world) {
+  *world += "Beeper: (" + std::to_string(x) + ", " + std::to_string(y) +
+            ") " + std::to_string(count) + "\n";
+}
+
+// Carves a maze with a depth-first search which knocks down the wall to a
+// random unvisited neighbor, backtracking when there is none.
+void AppendMaze(int width, int height, Random* random, std::string* world) {
+  // Bit 0 is set when a cell's east wall is removed, bit 1 its north wall.
+  const uint8_t kEastOpen = 1;
+  const uint8_t kNorthOpen = 2;
+  size_t num_cells = static_cast<size_t>(width) * height;
+  std::vector<uint8_t> open(num_cells, 0);
+  std::vector<bool> visited(num_cells, false);
+  std::vector<size_t> stack = {0};
+  visited[0] = true;
+  while (!stack.empty()) {
+    size_t cell = stack.back();
+    int x = static_cast<int>(cell % width);
+    int y = static_cast<int>(cell / width);
+    size_t neighbors[4];
+    int num_neighbors = 0;
+    if (x + 1 < width && !visited[cell + 1]) {
+      neighbors[num_neighbors++] = cell + 1;
+    }
+    if (x > 0 && !visited[cell - 1]) {
+      neighbors[num_neighbors++] = cell - 1;
+    }
+    if (y + 1 < height && !visited[cell + width]) {
+      neighbors[num_neighbors++] = cell + width;
+    }
+    if (y > 0 && !visited[cell - width]) {
+      neighbors[num_neighbors++] = cell - width;
+    }
+    if (num_neighbors == 0) {
+      stack.pop_back();
+      continue;
+    }
+    size_t next = neighbors[random->Uniform(num_neighbors)];
+    // Open the wall on the lower-numbered cell's side.
+    bool same_row = next / width == cell / width;
+    open[std::min(cell, next)] |= same_row ? kEastOpen : kNorthOpen;
+    visited[next] = true;
+    stack.push_back(next);
+  }
+  for (size_t cell = 0; cell < num_cells; cell++) {
+    int x = static_cast<int>(cell % width) + 1;
+    int y = static_cast<int>(cell / width) + 1;
+    if (x < width && !(open[cell] & kEastOpen)) AppendWall(x, y, "east", world);
+    if (y < height && !(open[cell] & kNorthOpen)) {
+      AppendWall(x, y, "north", world);
+    }
+  }
+  AppendBeeper(width, height, 1, world);
+}
+
+void AppendBeeperField(int width, int height, Random* random,
+                       std::string* world) {
+  for (int y = 1; y <= height; y++) {
+    for (int x = 1; x <= width; x++) {
+      if (random->Uniform(4) == 0) {
+        AppendBeeper(x, y, 1 + random->Uniform(9), world);
+      }
+    }
+  }
+}
+
+// Walls off each ring of cells from the next ring inside it, leaving a gap
+// just above the ring's bottom left cell. A wall above that cell stops Karel
+// from taking the gap without going around the ring first.
+void AppendSpiral(int width, int height, std::string* world) {
+  int min_x = 1, max_x = width, min_y = 1, max_y = height;
+  while (min_x + 1 <= max_x - 1 && min_y + 1 <= max_y - 1) {
+    AppendWall(min_x, min_y, "north", world);
+    for (int x = min_x + 1; x <= max_x - 1; x++) {
+      AppendWall(x, min_y + 1, "south", world);
+      AppendWall(x, max_y - 1, "north", world);
+    }
+    for (int y = min_y + 1; y <= max_y - 1; y++) {
+      if (y > min_y + 1) AppendWall(min_x + 1, y, "west", world);
+      AppendWall(max_x - 1, y, "east", world);
+    }
+    min_x++;
+    max_x--;
+    min_y++;
+    max_y--;
+  }
+  AppendBeeper(min_x, min_y, 1, world);
+}
+
+void AppendRooms(int width, int height, Random* random, std::string* world) {
+  // Walls between columns of rooms, with a door in each room's wall.
+  for (int x = kRoomSize; x < width; x += kRoomSize) {
+    for (int bottom = 1; bottom <= height; bottom += kRoomSize) {
+      int top = std::min(bottom + kRoomSize - 1, height);
+      int door = bottom + random->Uniform(top - bottom + 1);
+      for (int y = bottom; y <= top; y++) {
+        if (y != door) AppendWall(x, y, "east", world);
+      }
+    }
+  }
+  // And between rows of rooms.
+  for (int y = kRoomSize; y < height; y += kRoomSize) {
+    for (int left = 1; left <= width; left += kRoomSize) {
+      int right = std::min(left + kRoomSize - 1, width);
+      int door = left + random->Uniform(right - left + 1);
+      for (int x = left; x <= right; x++) {
+        if (x != door) AppendWall(x, y, "north", world);
+      }
+    }
+  }
+  for (int bottom = 1; bottom <= height; bottom += kRoomSize) {
+    for (int left = 1; left <= width; left += kRoomSize) {
+      if (random->Uniform(2) == 0) continue;
+      int room_width = std::min(kRoomSize, width - left + 1);
+      int room_height = std::min(kRoomSize, height - bottom + 1);
+      AppendBeeper(left + random->Uniform(room_width),
+                   bottom + random->Uniform(room_height),
+                   1 + random->Uniform(9), world);
+    }
+  }
+}
+
+}  // namespace
+
+std::string GenerateWorld(WorldLayout layout, int width, int height,
+                          uint64_t seed) {
+  if (width < 1 || height < 1) {
+    throw std::string(
+        "Cannot generate a world less than 1 cell wide or less than 1 cell "
+        "tall");
+  }
+  Random random(seed);
+  std::string world = "Dimension: (" + std::to_string(width) + ", " +
+                      std::to_string(height) + ")\n";
+  switch (layout) {
+    case WorldLayout::kEmpty:
+      break;
+    case WorldLayout::kMaze:
+      AppendMaze(width, height, &random, &world);
+      break;
+    case WorldLayout::kBeeperField:
+      AppendBeeperField(width, height, &random, &world);
+      break;
+    case WorldLayout::kSpiral:
+      AppendSpiral(width, height, &world);
+      break;
+    case WorldLayout::kRooms:
+      AppendRooms(width, height, &random, &world);
+      break;
+  }
+  world += "BeeperBag: INFINITY\nKarel: (1, 1) East\n";
+  return world;
+}
+
+void GenerateWorldFile(const std::string& filename, WorldLayout layout,
+                       int width, int height, uint64_t seed) {
+  std::string world = GenerateWorld(layout, width, height, seed);
+  std::ofstream file(filename);
+  if (!(file << world)) {
+    throw "Error writing file " + filename;
+  }
+}
+
+}  // namespace karel
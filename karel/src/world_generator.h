@@ -0,0 +1,53 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <stdint.h>
+
+#include <string>
+
+#ifndef WORLD_GENERATOR_H
+#define WORLD_GENERATOR_H
+
+namespace karel {
+
+/**
+ * The kinds of worlds GenerateWorld can build.
+ */
+enum class WorldLayout {
+  // No walls or beepers.
+  kEmpty,
+  // A maze with exactly one path between any two cells, and a beeper in the
+  // top right cell.
+  kMaze,
+  // Piles of 1 to 9 beepers in about a quarter of the cells.
+  kBeeperField,
+  // A corridor winding inwards from the bottom left cell, with a beeper where
+  // the innermost turn starts.
+  kSpiral,
+  // 5x5 rooms, with a door in each wall and beepers in about half the rooms.
+  kRooms,
+};
+
+/**
+ * Returns the text of a |width| by |height| Karel world file with the given
+ * |layout|, with Karel in the bottom left cell facing east and an infinite
+ * beeper bag. The world depends only on the arguments, so the same |seed|
+ * always gives the same world on every platform. Load it from memory with
+ * Robot::LoadWorldFromString.
+ */
+std::string GenerateWorld(WorldLayout layout, int width, int height,
+                          uint64_t seed = 0);
+
+/**
+ * Like GenerateWorld, but writes the world to |filename|. Throws a
+ * std::string if the file cannot be written.
+ */
+void GenerateWorldFile(const std::string& filename, WorldLayout layout,
+                       int width, int height, uint64_t seed = 0);
+
+}  // namespace karel
+
+#endif  // WORLD_GENERATOR_H
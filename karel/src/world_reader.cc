@@ -0,0 +1,160 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "world_reader.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+namespace karel {
+
+namespace {
+
+// The characters std::isspace accepts in the "C" locale.
+bool IsSpace(char c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' ||
+         c == '\f';
+}
+
+bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+// Longest number ReadDouble will consider.
+const size_t kMaxDoubleLength = 64;
+
+}  // namespace
+
+void WorldReader::SkipWhitespace() {
+  while (position_ < end_ && IsSpace(*position_)) {
+    position_++;
+  }
+}
+
+bool WorldReader::ReadToken(std::string_view* token) {
+  SkipWhitespace();
+  const char* start = position_;
+  while (position_ < end_ && !IsSpace(*position_)) {
+    position_++;
+  }
+  *token = std::string_view(start, position_ - start);
+  return position_ != start;
+}
+
+bool WorldReader::ReadChar(char* c) {
+  SkipWhitespace();
+  if (position_ == end_) return false;
+  *c = *position_++;
+  return true;
+}
+
+bool WorldReader::ReadInt(int* value) {
+  SkipWhitespace();
+  const char* int_end = ScanInt(position_, end_, value);
+  if (int_end == nullptr) return false;
+  position_ = int_end;
+  return true;
+}
+
+bool WorldReader::ReadDouble(double* value) {
+  SkipWhitespace();
+  // strtod needs a null-terminated string, so copy the characters which may
+  // be part of the number.
+  char buffer[kMaxDoubleLength + 1];
+  size_t length = 0;
+  while (position_ + length < end_ && length < kMaxDoubleLength) {
+    char c = position_[length];
+    if (!IsDigit(c) && c != '.' && c != '+' && c != '-' && c != 'e' &&
+        c != 'E') {
+      break;
+    }
+    buffer[length++] = c;
+  }
+  buffer[length] = '\0';
+  char* number_end;
+  *value = strtod(buffer, &number_end);
+  if (number_end == buffer) return false;
+  position_ += number_end - buffer;
+  return true;
+}
+
+bool WorldReader::ParseInt(std::string_view text, int* value) {
+  const char* begin = text.data();
+  const char* end = begin + text.size();
+  while (begin < end && IsSpace(*begin)) {
+    begin++;
+  }
+  return ScanInt(begin, end, value) != nullptr;
+}
+
+const char* WorldReader::ScanInt(const char* begin, const char* end,
+                                 int* value) {
+  const char* p = begin;
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p++;
+  }
+  if (p == end || !IsDigit(*p)) return nullptr;
+  // Accumulate as a negative number, which has the larger range.
+  const int64_t limit = negative
+                            ? static_cast<int64_t>(
+                                  std::numeric_limits<int>::min())
+                            : -static_cast<int64_t>(
+                                  std::numeric_limits<int>::max());
+  int64_t result = 0;
+  while (p < end && IsDigit(*p)) {
+    result = result * 10 - (*p - '0');
+    if (result < limit) return nullptr;
+    p++;
+  }
+  *value = static_cast<int>(negative ? result : -result);
+  return p;
+}
+
+MappedFile::~MappedFile() {
+  if (mapped_) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+}
+
+bool MappedFile::Open(const std::string& filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) &&
+      file_stat.st_size > 0) {
+    void* data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd,
+                      0);
+    if (data != MAP_FAILED) {
+      close(fd);
+      data_ = static_cast<const char*>(data);
+      size_ = file_stat.st_size;
+      mapped_ = true;
+      return true;
+    }
+  }
+  close(fd);
+  // Empty files and special files cannot be mapped.
+  std::ifstream file(filename, std::ios::binary);
+  if (!file.is_open()) return false;
+  std::stringstream contents;
+  contents << file.rdbuf();
+  buffer_ = contents.str();
+  data_ = buffer_.data();
+  size_ = buffer_.size();
+  return true;
+}
+
+}  // namespace karel
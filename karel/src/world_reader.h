@@ -0,0 +1,101 @@
+// Copyright 2020 Paul Salvador Inventado and Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include <stddef.h>
+
+#include <string>
+#include <string_view>
+
+#ifndef WORLD_READER_H
+#define WORLD_READER_H
+
+namespace karel {
+
+/**
+ * Reads whitespace-separated tokens from a world file held in memory,
+ * without copying. Reads behave like the std::istream extraction operators
+ * they replace: each skips leading whitespace (including newlines) and
+ * returns false if the expected value is not next.
+ */
+class WorldReader {
+ public:
+  /**
+   * Reads from the |size| bytes at |data|, which must outlive the reader and
+   * need not be null-terminated.
+   */
+  WorldReader(const char* data, size_t size)
+      : position_(data), end_(data + size) {}
+
+  /**
+   * Reads the next run of non-whitespace characters. |token| points into the
+   * underlying data.
+   */
+  bool ReadToken(std::string_view* token);
+
+  /**
+   * Reads the next non-whitespace character.
+   */
+  bool ReadChar(char* c);
+
+  /**
+   * Reads a decimal integer with an optional sign. Fails if there are no
+   * digits or the value does not fit in an int.
+   */
+  bool ReadInt(int* value);
+
+  /**
+   * Reads a decimal floating point number.
+   */
+  bool ReadDouble(double* value);
+
+  /**
+   * Parses a decimal integer at the start of |text| and ignores the rest,
+   * like std::stoi. Returns false if there is no integer or it is out of
+   * range.
+   */
+  static bool ParseInt(std::string_view text, int* value);
+
+ private:
+  void SkipWhitespace();
+
+  // Scans an integer in [begin, end). Returns the end of the integer, or
+  // nullptr if there is none or it is out of range.
+  static const char* ScanInt(const char* begin, const char* end, int* value);
+
+  const char* position_;
+  const char* end_;
+};
+
+/**
+ * A read-only file mapped into memory. Falls back to reading the file into
+ * a buffer where it cannot be mapped.
+ */
+class MappedFile {
+ public:
+  MappedFile() = default;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile();
+
+  /**
+   * Maps |filename|. Returns false if it cannot be opened.
+   */
+  bool Open(const std::string& filename);
+
+  const char* GetData() const { return data_; }
+  size_t GetSize() const { return size_; }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  bool mapped_ = false;
+  // Holds the contents when the file was read rather than mapped.
+  std::string buffer_;
+};
+
+}  // namespace karel
+
+#endif  // WORLD_READER_H